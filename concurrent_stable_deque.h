@@ -0,0 +1,136 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "stable_deque.h"
+
+/// Thread safe double ended queue made of two `stable_deque` halves, each behind its own mutex.
+/// Front operations only lock the front half and back operations the back half, so a producer on
+/// one end and a consumer on the other don't contend. Popping from an empty half is the only
+/// operation that crosses `middle`: it takes both locks (always front first) and swaps the two
+/// halves, which hands everything in the other half over in O(1), so a FIFO consumer takes the
+/// second lock once per batch rather than once per element.
+///
+/// `stable_deque::swap()` only exchanges the node tables, so the usual `stable_deque` guarantee
+/// holds: an element keeps its address until it is popped.
+template <typename T, typename Allocator = std::allocator<T>, typename Options = stable_deque_options>
+class concurrent_stable_deque
+{
+	using Half = stable_deque<T, Allocator, Options>;
+
+	/// One cache line each, so the two ends don't false share
+	struct alignas(64) Side
+	{
+		std::mutex mutex;
+		Half data;
+	};
+
+	/// Logically `front.data` followed by `back.data`
+	Side front;
+	Side back;
+
+public:
+	using value_type = T;
+	using size_type = std::size_t;
+
+	concurrent_stable_deque() = default;
+	concurrent_stable_deque(const concurrent_stable_deque &) = delete;
+	concurrent_stable_deque &operator=(const concurrent_stable_deque &) = delete;
+
+	void push_front(const T &value)
+	{
+		emplace_front(value);
+	}
+
+	void push_front(T &&value)
+	{
+		emplace_front(std::move(value));
+	}
+
+	void push_back(const T &value)
+	{
+		emplace_back(value);
+	}
+
+	void push_back(T &&value)
+	{
+		emplace_back(std::move(value));
+	}
+
+	template <typename... Args>
+	void emplace_front(Args &&...args)
+	{
+		std::lock_guard lock(front.mutex);
+		front.data.emplace_front(std::forward<Args>(args)...);
+	}
+
+	template <typename... Args>
+	void emplace_back(Args &&...args)
+	{
+		std::lock_guard lock(back.mutex);
+		back.data.emplace_back(std::forward<Args>(args)...);
+	}
+
+	/// Removes and returns the first element, or nothing if the deque is empty
+	std::optional<T> try_pop_front()
+	{
+		std::lock_guard frontLock(front.mutex);
+		if (front.data.empty())
+		{
+			// Take over whatever the back half holds
+			std::lock_guard backLock(back.mutex);
+			if (back.data.empty())
+				return std::nullopt;
+			front.data.swap(back.data);
+		}
+		return front.data.try_pop_front();
+	}
+
+	/// Removes and returns the last element, or nothing if the deque is empty
+	std::optional<T> try_pop_back()
+	{
+		{
+			std::lock_guard backLock(back.mutex);
+			if (!back.data.empty())
+				return back.data.try_pop_back();
+		}
+
+		// Take over whatever the front half holds, which needs both locks (front first)
+		std::lock_guard frontLock(front.mutex);
+		std::lock_guard backLock(back.mutex);
+		if (back.data.empty())
+		{
+			if (front.data.empty())
+				return std::nullopt;
+			back.data.swap(front.data);
+		}
+		return back.data.try_pop_back();
+	}
+
+	/// Snapshot of the size, takes both locks
+	size_type size()
+	{
+		std::lock_guard frontLock(front.mutex);
+		std::lock_guard backLock(back.mutex);
+		return front.data.size() + back.data.size();
+	}
+
+	bool empty()
+	{
+		return size() == 0;
+	}
+
+	/// Calls `function` on every element in order while holding both locks
+	template <typename Function>
+	void for_each(Function function)
+	{
+		std::lock_guard frontLock(front.mutex);
+		std::lock_guard backLock(back.mutex);
+		front.data.for_each(std::ref(function));
+		back.data.for_each(std::ref(function));
+	}
+};
@@ -0,0 +1,1731 @@
+// Benchmark suite for `stable_deque` and friends.
+//
+// Every case is run once to warm up, then `--repetitions` times at each size of `--sizes`, and the
+// median and p99 (nearest rank) of the wall clock time are reported. The repetitions of cases that
+// are compared with each other (same element type and op) are interleaved. Results can be written as CSV
+// and/or JSON, and compared against a CSV written by an earlier run:
+//
+//     deque_bench --sizes 1000,10000,100000 --csv new.csv --baseline old.csv --threshold 0.10
+//
+// exits with 1 if any case's median got slower than the baseline's by more than the threshold.
+// With STABLE_DEQUE_PERF_COUNTERS set, hardware counters per operation are printed next to the times.
+//
+// Besides single operations there are mixed workloads (FIFO steady state, random reads, iteration,
+// middle edits), multithreaded ones for the concurrent containers (at 1, 2, 4, ... threads), and
+// `--trace file` replays a recorded operation log instead, one op per line:
+//
+//     push_back <value> | push_front <value> | pop_front | pop_back
+//     insert <index> <value> | erase <index> | read <index> | iterate
+//
+// Indices are taken modulo the current size, so any log replays on any container.
+// `--make-trace file count` writes a log of the `mixed_op` workload to start from.
+#include "concurrent_stable_deque.h"
+#include "intrusive_stable_deque.h"
+#include "perf_counters.h"
+#include "stable_deque.h"
+#include "stable_deque_snapshot.h"
+#include "vector_stable_deque.h"
+#include "work_stealing_deque.h"
+
+#include <boost/container/stable_vector.hpp>
+#include <boost/pool/pool_alloc.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace
+{
+
+using boost::container::stable_vector;
+
+struct BigData
+{
+	constexpr static std::size_t size = 512;
+	std::array<int, size> data{};
+	BigData(int val)
+	{
+		std::fill(data.begin(), data.end(), val);
+	}
+};
+
+struct unpooled_options : stable_deque_options
+{
+	static constexpr bool pooled_nodes = false;
+};
+
+struct tombstone_options : stable_deque_options
+{
+	static constexpr bool tombstone_erase = true;
+};
+
+struct blocked_options : stable_deque_options
+{
+	static constexpr std::size_t position_block_size = 1024;
+};
+
+struct slot_options : stable_deque_options
+{
+	static constexpr bool slot_positions = true;
+};
+
+struct ordered_options : stable_deque_options
+{
+	static constexpr bool ordered_node_placement = true;
+};
+
+struct prefetch_options : stable_deque_options
+{
+	static constexpr std::size_t prefetch_distance = 8;
+};
+
+// Read at runtime, so the compiler can't fold the pushed values
+volatile int seed = 7;
+
+// Whatever a case computes ends up here, so it can't be optimized away
+volatile int64_t sink = 0;
+
+template<typename T>
+int value_of(const T &value)
+{
+	if constexpr (std::same_as<T, BigData>)
+		return value.data[0];
+	else
+		return value;
+}
+
+using Clock = std::chrono::steady_clock;
+
+/// Hardware counters around every timed region, set up by `main()` when STABLE_DEQUE_PERF_COUNTERS
+/// is set and the machine lets us open any
+perf_counters *counters = nullptr;
+
+/// What the counters read over the last timed region, and how many operations it did
+perf_counters::Reading lastReading;
+uint64_t lastOperations = 0;
+
+/// Wall clock, and the hardware counters if on, around the timed region of an op
+class Timer
+{
+	Clock::time_point start;
+
+public:
+	Timer()
+	{
+		if (counters)
+			counters->start();
+		start = Clock::now();
+	}
+
+	/// Ends the timed region, which did `operations` of whatever the op counts: pushes, rounds of
+	/// push + pop, lookups, tasks... The counters are reported per operation. Returns nanoseconds.
+	int64_t stop(uint64_t operations)
+	{
+		auto elapsed = Clock::now() - start;
+		if (counters)
+			lastReading = counters->stop();
+		lastOperations = operations;
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	}
+};
+
+/// Column of case names in the printed tables, fits the longest one
+constexpr int nameWidth = 74;
+
+/// Times one run of a case at size `n`, setup excluded
+using CaseFunction = std::function<int64_t(std::size_t n)>;
+
+struct Case
+{
+	std::string name;
+	CaseFunction run;
+
+	/// Quadratic cases are skipped above this size
+	std::size_t maxN = SIZE_MAX;
+};
+
+// Each op builds its container outside of the timed region, times the rest with a `Timer` and
+// returns nanoseconds
+
+template<typename T, typename Container>
+int64_t push_back_op(std::size_t n)
+{
+	Container container;
+	T value(seed);
+	Timer timer;
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(value);
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+template<typename T, typename Container>
+int64_t push_front_op(std::size_t n)
+{
+	Container container;
+	T value(seed);
+	Timer timer;
+	for (std::size_t i = 0; i < n; i++)
+		container.insert(container.begin(), value);
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+template<typename T, typename Container>
+int64_t erase_front_op(std::size_t n)
+{
+	Container container;
+	T value(seed);
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(value);
+	Timer timer;
+	for (std::size_t i = 0; i < n; i++)
+		container.erase(container.begin());
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+template<typename T, typename Container>
+int64_t erase_back_op(std::size_t n)
+{
+	Container container;
+	T value(seed);
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(value);
+	Timer timer;
+	for (std::size_t i = 0; i < n; i++)
+		container.erase(container.end() - 1);
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+// `n` rounds of `push_back` + `erase(begin())` on a queue of 5000
+template<typename T, typename Container>
+int64_t churn_op(std::size_t n)
+{
+	Container container;
+	T value(seed);
+	for (std::size_t i = 0; i < 5000; i++)
+		container.push_back(value);
+	Timer timer;
+	for (std::size_t i = 0; i < n; i++)
+	{
+		container.push_back(value);
+		container.erase(container.begin());
+	}
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+template<typename T, typename Container>
+int64_t index_sum_op(std::size_t n)
+{
+	Container container;
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)i + seed));
+	Timer timer;
+	int64_t sum = 0;
+	for (std::size_t i = 0; i < n; i++)
+		sum += value_of(container[i]);
+	int64_t elapsed = timer.stop(n);
+	sink = sink + sum;
+	return elapsed;
+}
+
+// The middle half of `n` elements erased with one `erase(first, last)`, or one element at a time
+template<typename T, typename Container, bool oneCall = true>
+int64_t erase_half_op(std::size_t n)
+{
+	Container container;
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)i + seed));
+	Timer timer;
+	if constexpr (oneCall)
+	{
+		container.erase(container.begin() + n / 4, container.begin() + n / 4 * 3);
+	}
+	else
+	{
+		for (std::size_t i = n / 4; i < n / 4 * 3; i++)
+			container.erase(container.begin() + n / 4);
+	}
+	int64_t elapsed = timer.stop(n / 4 * 3 - n / 4);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+// `std::sort` of `n` random values, then `n` `std::lower_bound` lookups
+template<typename T, typename Container>
+int64_t sort_search_op(std::size_t n)
+{
+	Container container;
+	std::mt19937 rng(seed);
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)(rng() % n)));
+	Timer timer;
+	std::sort(container.begin(), container.end());
+	int64_t found = 0;
+	for (std::size_t i = 0; i < n; i++)
+		found += std::lower_bound(container.begin(), container.end(), T((int)i)) - container.begin();
+	int64_t elapsed = timer.stop(n);
+	sink = sink + found;
+	return elapsed;
+}
+
+enum class Construction
+{
+	Copy,
+	Move,
+	Emplace,
+};
+
+// Heap owning payloads are strings past the small string optimization
+template<typename T>
+T make_payload(int value)
+{
+	if constexpr (std::same_as<T, std::string>)
+		return std::string(64, (char)('0' + value % 10));
+	else
+		return T(value);
+}
+
+// `n` elements pushed back as copies, moved in or constructed in place
+template<typename T, typename Container, Construction construction>
+int64_t construct_back_op(std::size_t n)
+{
+	Container container;
+	T value = make_payload<T>(seed);
+	std::vector<T> values;
+	if constexpr (construction == Construction::Move)
+		values.assign(n, value);
+	Timer timer;
+	for (std::size_t i = 0; i < n; i++)
+	{
+		if constexpr (construction == Construction::Copy)
+			container.push_back(value);
+		else if constexpr (construction == Construction::Move)
+			container.push_back(std::move(values[i]));
+		else if constexpr (std::same_as<T, std::string>)
+			container.emplace_back(64, (char)('0' + seed % 10));
+		else
+			container.emplace_back(seed);
+	}
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+// Workloads
+
+// FIFO steady state: a queue of `n` elements, `n` rounds of `push_back` + `erase(begin())`
+template<typename T, typename Container>
+int64_t fifo_steady_op(std::size_t n)
+{
+	Container container;
+	T value(seed);
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(value);
+	Timer timer;
+	for (std::size_t i = 0; i < n; i++)
+	{
+		container.push_back(value);
+		container.erase(container.begin());
+	}
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+// `pop_front()`/`pop_back()` counterparts of the erase ops, only for containers that have them
+template<typename T, typename Container>
+int64_t pop_front_op(std::size_t n)
+{
+	Container container;
+	T value(seed);
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(value);
+	Timer timer;
+	for (std::size_t i = 0; i < n; i++)
+		container.pop_front();
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+template<typename T, typename Container>
+int64_t pop_back_op(std::size_t n)
+{
+	Container container;
+	T value(seed);
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(value);
+	Timer timer;
+	for (std::size_t i = 0; i < n; i++)
+		container.pop_back();
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+template<typename T, typename Container>
+int64_t fifo_pop_op(std::size_t n)
+{
+	Container container;
+	T value(seed);
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(value);
+	Timer timer;
+	for (std::size_t i = 0; i < n; i++)
+	{
+		container.push_back(value);
+		sink = sink + value_of(container.front());
+		container.pop_front();
+	}
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+template<typename T, typename Container>
+int64_t random_read_op(std::size_t n)
+{
+	Container container;
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)i + seed));
+	std::mt19937 rng(seed);
+	std::vector<std::size_t> indices(n);
+	for (std::size_t &index : indices)
+		index = rng() % n;
+	Timer timer;
+	int64_t sum = 0;
+	for (std::size_t index : indices)
+		sum += value_of(container[index]);
+	int64_t elapsed = timer.stop(indices.size());
+	sink = sink + sum;
+	return elapsed;
+}
+
+template<typename T, typename Container>
+int64_t iterate_op(std::size_t n)
+{
+	Container container;
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)i + seed));
+	Timer timer;
+	int64_t sum = 0;
+	for (const T &value : container)
+		sum += value_of(value);
+	int64_t elapsed = timer.stop(n);
+	sink = sink + sum;
+	return elapsed;
+}
+
+// Fills `container` with `n` elements, then erases a random half and refills it, so the nodes
+// handed out by the allocator/pool are no longer in traversal order
+template<typename T, typename Container>
+void fill_aged(Container &container, std::size_t n)
+{
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)i + seed));
+	std::mt19937 rng(seed);
+	std::vector<char> eraseMask(n);
+	for (char &erase : eraseMask)
+		erase = rng() % 2;
+	std::size_t index = 0;
+	auto predicate = [&](const T &) { return eraseMask[index++] != 0; };
+	if constexpr (requires { container.erase_if(predicate); })
+		container.erase_if(predicate);
+	else
+		container.erase(std::remove_if(container.begin(), container.end(), predicate), container.end());
+	// `stable_vector` keeps the erased nodes in a pool of its own, and refilling from that pool is
+	// quadratic. Handing them back to the allocator first ages it through malloc's free lists instead.
+	if constexpr (std::same_as<Container, stable_vector<T>>)
+		container.shrink_to_fit();
+	for (std::size_t i = container.size(); i < n; i++)
+		container.push_back(T((int)i + seed));
+}
+
+enum class Traversal
+{
+	Loop,
+	ForEach,
+	Segment,
+};
+
+// Sum over an aged container with a range-for loop, `for_each` or `for_each_segment`
+template<typename T, typename Container, Traversal traversal = Traversal::Loop>
+int64_t aged_sum_op(std::size_t n)
+{
+	Container container;
+	fill_aged<T>(container, n);
+	Timer timer;
+	int64_t sum = 0;
+	if constexpr (traversal == Traversal::ForEach)
+	{
+		container.for_each([&](const T &value) { sum += value_of(value); });
+	}
+	else if constexpr (traversal == Traversal::Segment)
+	{
+		container.for_each_segment([&](auto segment) {
+			for (const T &value : segment)
+				sum += value_of(value);
+		});
+	}
+	else
+	{
+		for (const T &value : container)
+			sum += value_of(value);
+	}
+	int64_t elapsed = timer.stop(container.size());
+	sink = sink + sum;
+	return elapsed;
+}
+
+// Grows to `n` from both ends in random order and churns through half of it like a queue, then
+// sums everything. Where the nodes of each end land is what `ordered_node_placement` is about.
+template<typename T, typename Container, Traversal traversal = Traversal::Loop>
+int64_t two_ended_sum_op(std::size_t n)
+{
+	Container container;
+	std::mt19937 rng(seed);
+	for (std::size_t i = 0; i < n; i++)
+	{
+		if (rng() % 2 == 0)
+			container.push_back(T((int)i + seed));
+		else
+			container.push_front(T((int)i + seed));
+	}
+	for (std::size_t i = 0; i < n / 2; i++)
+	{
+		container.push_back(T((int)i + seed));
+		container.erase(container.begin());
+	}
+	Timer timer;
+	int64_t sum = 0;
+	if constexpr (traversal == Traversal::ForEach)
+	{
+		container.for_each([&](const T &value) { sum += value_of(value); });
+	}
+	else
+	{
+		for (const T &value : container)
+			sum += value_of(value);
+	}
+	int64_t elapsed = timer.stop(container.size());
+	sink = sink + sum;
+	return elapsed;
+}
+
+// Copy construction of a whole container
+template<typename T, typename Container>
+int64_t copy_op(std::size_t n)
+{
+	Container container;
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)i + seed));
+	Timer timer;
+	Container copy(container);
+	int64_t elapsed = timer.stop(n);
+	sink = sink + copy.size();
+	return elapsed;
+}
+
+// Whole life of a per-request deque, destruction included: fill it, drain half of it from the
+// front and scan the rest. `Resource` is the memory resource behind a `pmr::stable_deque`, built
+// and released inside the run as well, `void` stands for `std::allocator`.
+template<typename T, typename Resource, typename Options = stable_deque_options>
+int64_t request_op(std::size_t n)
+{
+	auto run = [&](auto &container) {
+		for (std::size_t i = 0; i < n; i++)
+			container.push_back(T((int)i + seed));
+		for (std::size_t i = 0; i < n / 2; i++)
+			container.pop_front();
+		int64_t sum = 0;
+		container.for_each([&](const T &value) { sum += value_of(value); });
+		return sum;
+	};
+	Timer timer;
+	int64_t sum;
+	if constexpr (std::is_void_v<Resource>)
+	{
+		stable_deque<T, std::allocator<T>, Options> container;
+		sum = run(container);
+	}
+	else
+	{
+		Resource resource;
+		::pmr::stable_deque<T, Options> container(&resource);
+		sum = run(container);
+	}
+	int64_t elapsed = timer.stop(n);
+	sink = sink + sum;
+	return elapsed;
+}
+
+// Object that already lives in the caller's own pool
+template<typename T>
+struct Pooled : stable_deque_hook<>
+{
+	T value;
+	Pooled(int val) : value(val)
+	{
+	}
+};
+
+// Queues `n` pooled objects and drains them from the front. `intrusive_stable_deque` links the
+// objects themselves, the other containers copy each one into storage of their own.
+template<typename T, typename Container>
+int64_t pooled_fifo_op(std::size_t n)
+{
+	std::vector<Pooled<T>> pool;
+	pool.reserve(n);
+	for (std::size_t i = 0; i < n; i++)
+		pool.emplace_back((int)i + seed);
+	Container container;
+	Timer timer;
+	for (Pooled<T> &object : pool)
+		container.push_back(object);
+	int64_t sum = 0;
+	while (!container.empty())
+	{
+		sum += value_of(container.front().value);
+		container.pop_front();
+	}
+	int64_t elapsed = timer.stop(pool.size());
+	sink = sink + sum;
+	return elapsed;
+}
+
+// 1000 inserts and erases at random spots of the middle half, whatever `n` is, while a reference
+// to an element at the front is kept and read after every edit. The stable containers keep it
+// valid; `std::deque`/`std::vector` get it re-fetched, which is what their users have to do too.
+template<typename T, typename Container>
+int64_t middle_edit_op(std::size_t n)
+{
+	constexpr bool stable = !std::same_as<Container, std::deque<T>> && !std::same_as<Container, std::vector<T>>;
+	Container container;
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)i + seed));
+	std::mt19937 rng(seed);
+	std::vector<std::size_t> offsets(2000);
+	for (std::size_t &offset : offsets)
+		offset = rng() % (n / 2 + 1);
+	T value(seed);
+	Timer timer;
+	const T *anchor = &container[0];
+	int64_t sum = 0;
+	for (std::size_t i = 0; i < offsets.size(); i += 2)
+	{
+		container.insert(container.begin() + n / 4 + offsets[i], value);
+		container.erase(container.begin() + n / 4 + offsets[i + 1]);
+		if constexpr (!stable)
+			anchor = &container[0];
+		sum += value_of(*anchor);
+	}
+	int64_t elapsed = timer.stop(offsets.size());
+	sink = sink + sum;
+	return elapsed;
+}
+
+// One pass over `n` elements that erases every other one through the returned iterator,
+// the burst of middle erases tombstones are meant for
+template<typename T, typename Container>
+int64_t sweep_erase_op(std::size_t n)
+{
+	Container container;
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)i + seed));
+	Timer timer;
+	bool erase = false;
+	for (auto iter = container.begin(); iter != container.end(); erase = !erase)
+		iter = erase ? container.erase(iter) : std::next(iter);
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	return elapsed;
+}
+
+// `n` random reads by index, after a fifth of `n` elements were erased from random middle spots:
+// below the compaction threshold, so with `tombstone_erase` every read has tombstones to count past
+template<typename T, typename Container>
+int64_t sparse_read_op(std::size_t n)
+{
+	Container container;
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)i + seed));
+	std::mt19937 rng(seed);
+	for (std::size_t i = 0; i < n / 5 && container.size() > 2; i++)
+		container.erase(container.begin() + 1 + rng() % (container.size() - 2));
+	std::vector<std::size_t> indices(n);
+	for (std::size_t &index : indices)
+		index = rng() % container.size();
+	Timer timer;
+	int64_t sum = 0;
+	for (std::size_t index : indices)
+		sum += value_of(container[index]);
+	int64_t elapsed = timer.stop(indices.size());
+	sink = sink + sum;
+	return elapsed;
+}
+
+// `std::deque` behind a single mutex, the baseline for the concurrent containers
+template<typename T>
+class locked_deque
+{
+	std::mutex mutex;
+	std::deque<T> data;
+
+public:
+	void push_back(const T &value)
+	{
+		std::lock_guard lock(mutex);
+		data.push_back(value);
+	}
+
+	// Work-stealing interface: the owner pushes and pops at the back, thieves steal from the front
+
+	void push(const T &value)
+	{
+		push_back(value);
+	}
+
+	std::optional<T> pop()
+	{
+		std::lock_guard lock(mutex);
+		if (data.empty())
+			return std::nullopt;
+		std::optional<T> value(std::move(data.back()));
+		data.pop_back();
+		return value;
+	}
+
+	std::optional<T> steal()
+	{
+		return try_pop_front();
+	}
+
+	std::optional<T> try_pop_front()
+	{
+		std::lock_guard lock(mutex);
+		if (data.empty())
+			return std::nullopt;
+		std::optional<T> value(std::move(data.front()));
+		data.pop_front();
+		return value;
+	}
+};
+
+// Producer/consumer FIFO of `n` ints: half of the `threads` `push_back`, the other half
+// `try_pop_front` until everything went through. A single thread alternates between the two.
+template<typename Container>
+int64_t producer_consumer_op(std::size_t n, int threads)
+{
+	Container container;
+	int value = seed;
+	int producers = std::max(1, threads / 2);
+	int consumers = std::max(1, threads - producers);
+	Timer timer;
+	if (threads == 1)
+	{
+		for (std::size_t i = 0; i < n; i++)
+		{
+			container.push_back(value);
+			container.try_pop_front();
+		}
+	}
+	else
+	{
+		std::atomic<std::size_t> consumed = 0;
+		std::vector<std::thread> workers;
+		for (int p = 0; p < producers; p++)
+			workers.emplace_back([&, p] {
+				for (std::size_t i = p; i < n; i += producers)
+					container.push_back(value);
+			});
+		for (int c = 0; c < consumers; c++)
+			workers.emplace_back([&] {
+				while (consumed < n)
+					if (container.try_pop_front())
+						consumed++;
+			});
+		for (std::thread &worker : workers)
+			worker.join();
+	}
+	int64_t elapsed = timer.stop(n);
+	return elapsed;
+}
+
+int64_t sequential_fib(int k)
+{
+	return k < 2 ? k : sequential_fib(k - 1) + sequential_fib(k - 2);
+}
+
+// Fork-join fib over one task queue per worker: a task forks its two subproblems onto its
+// worker's queue, idle workers steal from a random victim. Below the cutoff fib runs
+// sequentially. Computes the smallest fib(k) that takes at least `n` tasks.
+template<typename Queue>
+int64_t fork_join_fib_op(std::size_t n, int threads)
+{
+	constexpr int cutoff = 12;
+	int k = cutoff - 1;
+	int64_t tasks = 1;
+	for (int64_t previousTasks = 1; tasks < (int64_t)n; k++)
+		previousTasks = std::exchange(tasks, 1 + tasks + previousTasks);
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	for (int i = 0; i < threads; i++)
+		queues.push_back(std::make_unique<Queue>());
+	// Tasks that are queued or running
+	std::atomic<int64_t> pending = 1;
+	std::vector<int64_t> sums(threads);
+
+	Timer timer;
+	queues[0]->push(k);
+	auto worker = [&](int self) {
+		std::mt19937 rng(self);
+		int64_t sum = 0;
+		while (pending.load(std::memory_order_relaxed) > 0)
+		{
+			std::optional<int> task = queues[self]->pop();
+			if (!task && threads > 1)
+				task = queues[(self + 1 + rng() % (threads - 1)) % threads]->steal();
+			if (!task)
+				continue;
+			if (*task < cutoff)
+			{
+				sum += sequential_fib(*task);
+				pending.fetch_sub(1, std::memory_order_relaxed);
+				continue;
+			}
+			pending.fetch_add(1, std::memory_order_relaxed);
+			queues[self]->push(*task - 2);
+			queues[self]->push(*task - 1);
+		}
+		sums[self] = sum;
+	};
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threads; i++)
+		workers.emplace_back(worker, i);
+	worker(0);
+	for (std::thread &thread : workers)
+		thread.join();
+	int64_t elapsed = timer.stop((uint64_t)tasks);
+
+	int64_t sum = std::accumulate(sums.begin(), sums.end(), int64_t{});
+	if (sum != sequential_fib(k))
+		std::cerr << "fork_join_fib_op computed a wrong result\n";
+	sink = sink + sum;
+	return elapsed;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// Startup reload of a checkpoint of `n` elements: reading the payload and pushing element by
+// element against the two snapshot loaders. The snapshot is written before the clock starts.
+std::string snapshot_path(std::size_t n)
+{
+	return "/tmp/deque_bench_snapshot_" + std::to_string(::getpid()) + "_" + std::to_string(n);
+}
+
+int open_snapshot(const std::string &path, int flags)
+{
+	int fd = ::open(path.c_str(), flags | O_CLOEXEC, 0600);
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(), "open " + path);
+	return fd;
+}
+
+template<typename T, typename Container>
+std::string write_snapshot(std::size_t n)
+{
+	Container container;
+	for (std::size_t i = 0; i < n; i++)
+		container.push_back(T((int)i + seed));
+	std::string path = snapshot_path(n);
+	int fd = open_snapshot(path, O_WRONLY | O_CREAT | O_TRUNC);
+	save_snapshot(container, fd);
+	::close(fd);
+	return path;
+}
+
+template<typename T, typename Container>
+int64_t reload_push_back_op(std::size_t n)
+{
+	std::string path = write_snapshot<T, Container>(n);
+	Timer timer;
+	Container container;
+	int fd = open_snapshot(path, O_RDONLY);
+	stable_deque_snapshot_header header;
+	stable_deque_snapshot_detail::read_all(fd, &header, sizeof(header));
+	std::vector<T> buffer(std::max<std::size_t>(std::min<std::size_t>(stable_deque_snapshot_detail::bufferBytes / sizeof(T), n), 1), T(0));
+	for (std::size_t done = 0; done < header.size;)
+	{
+		std::size_t count = std::min<std::size_t>(buffer.size(), header.size - done);
+		stable_deque_snapshot_detail::read_all(fd, buffer.data(), count * sizeof(T));
+		for (std::size_t i = 0; i < count; i++)
+			container.push_back(buffer[i]);
+		done += count;
+	}
+	::close(fd);
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	::unlink(path.c_str());
+	return elapsed;
+}
+
+template<typename T, typename Container>
+int64_t load_snapshot_op(std::size_t n)
+{
+	std::string path = write_snapshot<T, Container>(n);
+	Timer timer;
+	Container container;
+	int fd = open_snapshot(path, O_RDONLY);
+	load_snapshot(container, fd);
+	::close(fd);
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	::unlink(path.c_str());
+	return elapsed;
+}
+
+template<typename T, typename Container>
+int64_t map_snapshot_op(std::size_t n)
+{
+	std::string path = write_snapshot<T, Container>(n);
+	Timer timer;
+	Container container;
+	map_snapshot(container, path.c_str());
+	int64_t elapsed = timer.stop(n);
+	sink = sink + container.size();
+	::unlink(path.c_str());
+	return elapsed;
+}
+#endif
+
+// Operation logs, see the top of the file
+
+enum class TraceOpKind
+{
+	PushBack,
+	PushFront,
+	PopFront,
+	PopBack,
+	Insert,
+	Erase,
+	Read,
+	Iterate,
+};
+
+struct TraceOp
+{
+	TraceOpKind kind;
+	std::size_t index = 0;
+	int value = 0;
+};
+
+using Trace = std::vector<TraceOp>;
+
+const std::array<std::string, 8> traceOpNames = { "push_back", "push_front", "pop_front", "pop_back", "insert", "erase", "read", "iterate" };
+
+/// Returns false on a malformed line
+bool read_trace(std::istream &in, Trace &trace)
+{
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		std::string name;
+		if (!(fields >> name) || name[0] == '#')
+			continue;
+		auto found = std::find(traceOpNames.begin(), traceOpNames.end(), name);
+		if (found == traceOpNames.end())
+			return false;
+		TraceOp op{ (TraceOpKind)(found - traceOpNames.begin()) };
+		bool ok = true;
+		switch (op.kind)
+		{
+		case TraceOpKind::PushBack:
+		case TraceOpKind::PushFront: ok = (bool)(fields >> op.value); break;
+		case TraceOpKind::Insert: ok = (bool)(fields >> op.index >> op.value); break;
+		case TraceOpKind::Erase:
+		case TraceOpKind::Read: ok = (bool)(fields >> op.index); break;
+		default: break;
+		}
+		if (!ok)
+			return false;
+		trace.push_back(op);
+	}
+	return true;
+}
+
+void write_trace(std::ostream &out, const Trace &trace)
+{
+	for (const TraceOp &op : trace)
+	{
+		out << traceOpNames[(std::size_t)op.kind];
+		switch (op.kind)
+		{
+		case TraceOpKind::PushBack:
+		case TraceOpKind::PushFront: out << ' ' << op.value; break;
+		case TraceOpKind::Insert: out << ' ' << op.index << ' ' << op.value; break;
+		case TraceOpKind::Erase:
+		case TraceOpKind::Read: out << ' ' << op.index; break;
+		default: break;
+		}
+		out << '\n';
+	}
+}
+
+/// Queue shaped traffic: mostly FIFO, plus random reads, the odd middle edit and full scan
+Trace make_mixed_trace(std::size_t count)
+{
+	std::mt19937 rng(seed);
+	Trace trace;
+	trace.reserve(count);
+	for (std::size_t i = 0; i < count; i++)
+	{
+		unsigned roll = rng() % 1000;
+		std::size_t index = rng();
+		int value = (int)(rng() % 1000);
+		if (roll < 350)
+			trace.push_back({ TraceOpKind::PushBack, 0, value });
+		else if (roll < 680)
+			trace.push_back({ TraceOpKind::PopFront });
+		else if (roll < 700)
+			trace.push_back({ TraceOpKind::PushFront, 0, value });
+		else if (roll < 720)
+			trace.push_back({ TraceOpKind::PopBack });
+		else if (roll < 950)
+			trace.push_back({ TraceOpKind::Read, index });
+		else if (roll < 970)
+			trace.push_back({ TraceOpKind::Insert, index, value });
+		else if (roll < 990)
+			trace.push_back({ TraceOpKind::Erase, index });
+		else
+			trace.push_back({ TraceOpKind::Iterate });
+	}
+	return trace;
+}
+
+template<typename T, typename Container>
+int64_t replay(const Trace &trace)
+{
+	Container container;
+	Timer timer;
+	int64_t sum = 0;
+	for (const TraceOp &op : trace)
+	{
+		std::size_t size = container.size();
+		switch (op.kind)
+		{
+		case TraceOpKind::PushBack: container.push_back(T(op.value)); break;
+		case TraceOpKind::PushFront: container.insert(container.begin(), T(op.value)); break;
+		// Pops go through `pop_front()`/`pop_back()` where the container has them, like a queue worker would
+		case TraceOpKind::PopFront:
+			if (size == 0)
+				break;
+			if constexpr (requires { container.pop_front(); })
+				container.pop_front();
+			else
+				container.erase(container.begin());
+			break;
+		case TraceOpKind::PopBack:
+			if (size == 0)
+				break;
+			if constexpr (requires { container.pop_back(); })
+				container.pop_back();
+			else
+				container.erase(container.end() - 1);
+			break;
+		case TraceOpKind::Insert: container.insert(container.begin() + op.index % (size + 1), T(op.value)); break;
+		case TraceOpKind::Erase:
+			if (size > 0)
+				container.erase(container.begin() + op.index % size);
+			break;
+		case TraceOpKind::Read:
+			if (size > 0)
+				sum += value_of(container[op.index % size]);
+			break;
+		case TraceOpKind::Iterate:
+			for (const T &value : container)
+				sum += value_of(value);
+			break;
+		}
+	}
+	int64_t elapsed = timer.stop(trace.size());
+	sink = sink + sum;
+	return elapsed;
+}
+
+// The mixed trace at `n` ops, generated outside the timed region
+template<typename T, typename Container>
+int64_t mixed_op(std::size_t n)
+{
+	Trace trace = make_mixed_trace(n);
+	return replay<T, Container>(trace);
+}
+
+// Registers `op` for every container of the main comparison
+#define ADD_CONTAINERS(op, T, quadraticMaxN) \
+	cases.push_back({ "std::deque<" #T ">/" #op, op<T, std::deque<T>>, quadraticMaxN.deque }); \
+	cases.push_back({ "stable_deque<" #T ">/" #op, op<T, stable_deque<T>> }); \
+	cases.push_back({ "vector_stable_deque<" #T ">/" #op, op<T, vector_stable_deque<T>>, quadraticMaxN.vectorStableDeque }); \
+	cases.push_back({ "stable_vector<" #T ">/" #op, op<T, stable_vector<T>>, quadraticMaxN.stableVector }); \
+	cases.push_back({ "std::vector<" #T ">/" #op, op<T, std::vector<T>>, quadraticMaxN.vector });
+
+// Node pool (default) against one allocator call per node
+#define ADD_ALLOCATORS(op, T) \
+	cases.push_back({ "stable_deque<" #T "> (node pool)/" #op, op<T, stable_deque<T>> }); \
+	cases.push_back({ "stable_deque<" #T "> (std::allocator)/" #op, op<T, stable_deque<T, std::allocator<T>, unpooled_options>> }); \
+	cases.push_back({ "stable_deque<" #T "> (fast_pool_allocator)/" #op, op<T, stable_deque<T, boost::fast_pool_allocator<T>, unpooled_options>> });
+
+// Containers with `pop_front()`/`pop_back()`
+#define ADD_POPPING(op, T) \
+	cases.push_back({ "std::deque<" #T ">/" #op, op<T, std::deque<T>> }); \
+	cases.push_back({ "stable_deque<" #T ">/" #op, op<T, stable_deque<T>> });
+
+// Middle erases that only leave tombstones behind
+#define ADD_TOMBSTONES(op, T) \
+	cases.push_back({ "stable_deque<" #T "> (tombstones)/" #op, op<T, stable_deque<T, std::allocator<T>, tombstone_options>> }); \
+	cases.push_back({ "vector_stable_deque<" #T "> (tombstones)/" #op, op<T, vector_stable_deque<T, std::allocator<T>, tombstone_options>> });
+
+// Checkpoint reload, element by element against the snapshot loaders. `maxN` keeps the
+// snapshot files of big elements from filling up /tmp.
+#define ADD_SNAPSHOTS(T, maxN) \
+	cases.push_back({ "stable_deque<" #T ">/reload_push_back_op", reload_push_back_op<T, stable_deque<T>>, maxN }); \
+	cases.push_back({ "stable_deque<" #T ">/load_snapshot_op", load_snapshot_op<T, stable_deque<T>>, maxN }); \
+	cases.push_back({ "stable_deque<" #T ">/map_snapshot_op", map_snapshot_op<T, stable_deque<T>>, maxN });
+
+// `std::allocator` against a `pmr::stable_deque` on a `monotonic_buffer_resource` or an
+// `unsynchronized_pool_resource`, with the node pool and with one allocation per node
+#define ADD_RESOURCES(op, T) \
+	cases.push_back({ "stable_deque<" #T "> (std::allocator)/" #op, op<T, void> }); \
+	cases.push_back({ "stable_deque<" #T "> (monotonic)/" #op, op<T, std::pmr::monotonic_buffer_resource> }); \
+	cases.push_back({ "stable_deque<" #T "> (pool)/" #op, op<T, std::pmr::unsynchronized_pool_resource> }); \
+	cases.push_back({ "stable_deque<" #T "> (unpooled)/" #op, op<T, void, unpooled_options> }); \
+	cases.push_back({ "stable_deque<" #T "> (unpooled, monotonic)/" #op, op<T, std::pmr::monotonic_buffer_resource, unpooled_options> }); \
+	cases.push_back({ "stable_deque<" #T "> (unpooled, pool)/" #op, op<T, std::pmr::unsynchronized_pool_resource, unpooled_options> });
+
+// One `erase(first, last)` against the same erase one element at a time, which is quadratic
+#define ADD_ERASE_HALF(Container, T) \
+	cases.push_back({ #Container "<" #T ">/erase_half_op", erase_half_op<T, Container<T>> }); \
+	cases.push_back({ #Container "<" #T "> (one at a time)/erase_half_op", erase_half_op<T, Container<T>, false>, 10000 });
+
+// `push_back(const T&)` against `push_back(T&&)` and `emplace_back(...)`
+#define ADD_CONSTRUCTIONS(Container, T) \
+	cases.push_back({ #Container "<" #T "> (copy)/construct_back_op", construct_back_op<T, Container<T>, Construction::Copy> }); \
+	cases.push_back({ #Container "<" #T "> (move)/construct_back_op", construct_back_op<T, Container<T>, Construction::Move> }); \
+	cases.push_back({ #Container "<" #T "> (emplace)/construct_back_op", construct_back_op<T, Container<T>, Construction::Emplace> });
+
+// Traversal after growing at both ends, with and without `ordered_node_placement`
+#define ADD_PLACEMENTS(op, T, maxN) \
+	cases.push_back({ "std::deque<" #T ">/" #op, op<T, std::deque<T>>, maxN }); \
+	cases.push_back({ "stable_deque<" #T ">/" #op, op<T, stable_deque<T>>, maxN }); \
+	cases.push_back({ "stable_deque<" #T "> (ordered_node_placement)/" #op, op<T, stable_deque<T, std::allocator<T>, ordered_options>>, maxN }); \
+	cases.push_back({ "stable_deque<" #T "> (for_each)/" #op, op<T, stable_deque<T>, Traversal::ForEach>, maxN }); \
+	cases.push_back({ "stable_deque<" #T "> (ordered_node_placement, for_each)/" #op, op<T, stable_deque<T, std::allocator<T>, ordered_options>, Traversal::ForEach>, maxN });
+
+// The concurrent containers against `locked_deque` at 1, 2, 4, ... threads, up to the core count
+#define ADD_THREADED(op, Baseline, Container) \
+	for (int threads = 1; threads <= maxThreads; threads *= 2) \
+	{ \
+		std::string suffix = " (" + std::to_string(threads) + " threads)/" #op; \
+		cases.push_back({ #Baseline + suffix, [threads](std::size_t n) { return op<Baseline>(n, threads); } }); \
+		cases.push_back({ #Container + suffix, [threads](std::size_t n) { return op<Container>(n, threads); } }); \
+	}
+
+// Default node positions against the block-relative and the slot table ones
+#define ADD_POSITION_MODES(op, T) \
+	cases.push_back({ "stable_deque<" #T "> (position_block_size = 1024)/" #op, op<T, stable_deque<T, std::allocator<T>, blocked_options>> }); \
+	cases.push_back({ "stable_deque<" #T "> (slot_positions)/" #op, op<T, stable_deque<T, std::allocator<T>, slot_options>> });
+
+// Plain loops against the traversal helpers, over aged containers
+#define ADD_TRAVERSALS(op, T, maxN) \
+	cases.push_back({ "std::deque<" #T ">/" #op, op<T, std::deque<T>>, maxN }); \
+	cases.push_back({ "stable_vector<" #T ">/" #op, op<T, stable_vector<T>>, maxN }); \
+	cases.push_back({ "stable_deque<" #T ">/" #op, op<T, stable_deque<T>>, maxN }); \
+	cases.push_back({ "stable_deque<" #T "> (for_each)/" #op, op<T, stable_deque<T>, Traversal::ForEach>, maxN }); \
+	cases.push_back({ "stable_deque<" #T "> (for_each, prefetch 8)/" #op, op<T, stable_deque<T, std::allocator<T>, prefetch_options>, Traversal::ForEach>, maxN }); \
+	cases.push_back({ "stable_deque<" #T "> (for_each_segment)/" #op, op<T, stable_deque<T>, Traversal::Segment>, maxN }); \
+	cases.push_back({ "vector_stable_deque<" #T ">/" #op, op<T, vector_stable_deque<T>>, maxN }); \
+	cases.push_back({ "vector_stable_deque<" #T "> (for_each)/" #op, op<T, vector_stable_deque<T>, Traversal::ForEach>, maxN });
+
+// Pooled objects copied into `std::deque`/`stable_deque` against linked into `intrusive_stable_deque`
+#define ADD_INTRUSIVE(op, T) \
+	cases.push_back({ "std::deque<" #T ">/" #op, op<T, std::deque<Pooled<T>>> }); \
+	cases.push_back({ "stable_deque<" #T ">/" #op, op<T, stable_deque<Pooled<T>>> }); \
+	cases.push_back({ "intrusive_stable_deque<" #T ">/" #op, op<T, intrusive_stable_deque<Pooled<T>>> });
+
+/// Largest sizes the containers that are O(n) per op are run at
+struct QuadraticMaxN
+{
+	std::size_t vectorStableDeque = SIZE_MAX;
+	std::size_t stableVector = SIZE_MAX;
+	std::size_t vector = SIZE_MAX;
+	std::size_t deque = SIZE_MAX;
+};
+
+std::vector<Case> make_cases()
+{
+	std::vector<Case> cases;
+	constexpr QuadraticMaxN linear{};
+	constexpr QuadraticMaxN front{ 10000, 10000, 10000 };
+	constexpr QuadraticMaxN bigFront{ 10000, 10000, 1000 };
+	constexpr QuadraticMaxN back{ 10000, SIZE_MAX, SIZE_MAX };
+	constexpr QuadraticMaxN churn{ 1000, 1000, 10000 };
+	constexpr QuadraticMaxN bigChurn{ 1000, 1000, 1000 };
+	constexpr QuadraticMaxN bigMiddle{ SIZE_MAX, SIZE_MAX, 10000, 10000 };
+
+	ADD_CONTAINERS(push_back_op, int, linear);
+	ADD_CONTAINERS(push_back_op, BigData, linear);
+	ADD_CONTAINERS(push_front_op, int, front);
+	ADD_CONTAINERS(push_front_op, BigData, bigFront);
+	ADD_CONTAINERS(erase_front_op, int, front);
+	ADD_CONTAINERS(erase_front_op, BigData, bigFront);
+	ADD_CONTAINERS(erase_back_op, int, back);
+	ADD_CONTAINERS(erase_back_op, BigData, back);
+	ADD_CONTAINERS(churn_op, int, churn);
+	ADD_CONTAINERS(index_sum_op, int, linear);
+	ADD_CONTAINERS(sort_search_op, int, linear);
+
+	ADD_ERASE_HALF(std::deque, int);
+	ADD_ERASE_HALF(stable_deque, int);
+	ADD_ERASE_HALF(vector_stable_deque, int);
+	ADD_ERASE_HALF(stable_vector, int);
+	ADD_ERASE_HALF(std::deque, BigData);
+	ADD_ERASE_HALF(stable_deque, BigData);
+	ADD_ERASE_HALF(vector_stable_deque, BigData);
+	ADD_ERASE_HALF(stable_vector, BigData);
+
+	ADD_CONSTRUCTIONS(std::deque, BigData);
+	ADD_CONSTRUCTIONS(stable_deque, BigData);
+	ADD_CONSTRUCTIONS(vector_stable_deque, BigData);
+	ADD_CONSTRUCTIONS(std::deque, std::string);
+	ADD_CONSTRUCTIONS(stable_deque, std::string);
+	ADD_CONSTRUCTIONS(vector_stable_deque, std::string);
+
+	ADD_CONTAINERS(fifo_steady_op, int, churn);
+	ADD_CONTAINERS(fifo_steady_op, BigData, bigChurn);
+	ADD_CONTAINERS(random_read_op, int, linear);
+	ADD_CONTAINERS(iterate_op, int, linear);
+	ADD_TRAVERSALS(aged_sum_op, int, SIZE_MAX);
+	ADD_TRAVERSALS(aged_sum_op, BigData, 100000);
+	ADD_PLACEMENTS(two_ended_sum_op, int, SIZE_MAX);
+	ADD_PLACEMENTS(two_ended_sum_op, BigData, 100000);
+	ADD_CONTAINERS(copy_op, int, linear);
+	ADD_CONTAINERS(copy_op, BigData, linear);
+	ADD_CONTAINERS(middle_edit_op, int, linear);
+	ADD_CONTAINERS(middle_edit_op, BigData, bigMiddle);
+	ADD_POSITION_MODES(middle_edit_op, int);
+	ADD_POSITION_MODES(middle_edit_op, BigData);
+	ADD_CONTAINERS(mixed_op, int, front);
+	ADD_CONTAINERS(sweep_erase_op, int, front);
+	ADD_TOMBSTONES(sweep_erase_op, int);
+	cases.push_back({ "std::deque<int>/sparse_read_op", sparse_read_op<int, std::deque<int>> });
+	cases.push_back({ "stable_deque<int>/sparse_read_op", sparse_read_op<int, stable_deque<int>> });
+	ADD_TOMBSTONES(sparse_read_op, int);
+
+	ADD_POPPING(pop_front_op, int);
+	ADD_POPPING(pop_back_op, int);
+	ADD_POPPING(fifo_pop_op, int);
+	ADD_POPPING(fifo_pop_op, BigData);
+
+#if defined(__unix__) || defined(__APPLE__)
+	ADD_SNAPSHOTS(int, SIZE_MAX);
+	ADD_SNAPSHOTS(BigData, 100000);
+#endif
+
+	ADD_ALLOCATORS(push_back_op, int);
+	ADD_ALLOCATORS(push_back_op, BigData);
+	ADD_ALLOCATORS(erase_front_op, int);
+	ADD_ALLOCATORS(churn_op, int);
+
+	ADD_RESOURCES(request_op, int);
+	ADD_RESOURCES(request_op, BigData);
+
+	ADD_INTRUSIVE(pooled_fifo_op, int);
+	ADD_INTRUSIVE(pooled_fifo_op, BigData);
+
+	int maxThreads = std::max(4, (int)std::thread::hardware_concurrency());
+	ADD_THREADED(producer_consumer_op, locked_deque<int>, concurrent_stable_deque<int>);
+	ADD_THREADED(fork_join_fib_op, locked_deque<int>, work_stealing_deque<int>);
+	return cases;
+}
+
+#define ADD_TRACE_CONTAINER(Container) \
+	cases.push_back({ #Container "<int>/" + name, [trace](std::size_t) { return replay<int, Container<int>>(*trace); } });
+
+std::vector<Case> make_trace_cases(std::shared_ptr<const Trace> trace, const std::string &name)
+{
+	std::vector<Case> cases;
+	ADD_TRACE_CONTAINER(std::deque);
+	ADD_TRACE_CONTAINER(stable_deque);
+	ADD_TRACE_CONTAINER(vector_stable_deque);
+	ADD_TRACE_CONTAINER(stable_vector);
+	ADD_TRACE_CONTAINER(std::vector);
+	return cases;
+}
+
+struct Result
+{
+	std::string name;
+	std::size_t n;
+	std::size_t repetitions;
+	int64_t medianNs;
+	int64_t p99Ns;
+
+	/// Hardware counters per operation over all repetitions, empty when they are off
+	std::string countersPerOp;
+
+	double ns_per_element() const
+	{
+		return (double)medianNs / (double)n;
+	}
+};
+
+/// Nearest rank percentile of sorted `samples`
+int64_t percentile(const std::vector<int64_t> &samples, double fraction)
+{
+	std::size_t rank = (std::size_t)std::ceil(fraction * (double)samples.size());
+	return samples[std::clamp<std::size_t>(rank, 1, samples.size()) - 1];
+}
+
+/// Cases that are compared with each other, e.g. on one chart: the element type and the op of
+/// `name`, without the container and its variant
+std::string comparison_of(const std::string &name)
+{
+	std::size_t opStart = name.rfind('/');
+	std::size_t typeStart = name.find('<');
+	std::size_t typeEnd = name.find('>', typeStart);
+	return name.substr(typeStart, typeEnd - typeStart + 1) + name.substr(opStart);
+}
+
+/// Runs one comparison at size `n`: every case once to warm up, then the repetitions of all of them
+/// interleaved, so whatever state the heap and the caches drift into is shared by every case of
+/// the comparison instead of being charged to whichever runs last
+std::vector<Result> run_comparison(const std::vector<const Case *> &comparison, std::size_t n, std::size_t repetitions)
+{
+	struct Samples
+	{
+		std::vector<int64_t> times;
+		perf_counters::Reading total;
+		uint64_t operations = 0;
+	};
+	auto run = [n](const Case &benchCase)
+	{
+		try
+		{
+			return benchCase.run(n);
+		}
+		catch (const std::exception &error)
+		{
+			throw std::runtime_error(benchCase.name + ": " + error.what());
+		}
+	};
+
+	std::vector<Samples> samples(comparison.size());
+	for (const Case *benchCase : comparison)
+		run(*benchCase);
+	for (std::size_t i = 0; i < repetitions; i++)
+		for (std::size_t c = 0; c < comparison.size(); c++)
+		{
+			Samples &caseSamples = samples[c];
+			caseSamples.times.push_back(run(*comparison[c]));
+			caseSamples.operations += lastOperations;
+			for (int event = 0; event < perf_counters::EventCount; event++)
+				if (lastReading[event])
+					caseSamples.total[event] = caseSamples.total[event].value_or(0) + *lastReading[event];
+		}
+
+	std::vector<Result> results;
+	for (std::size_t c = 0; c < comparison.size(); c++)
+	{
+		Samples &caseSamples = samples[c];
+		std::sort(caseSamples.times.begin(), caseSamples.times.end());
+		std::string countersPerOp = counters ? perf_counters::per_operation(caseSamples.total, caseSamples.operations) : std::string();
+		results.push_back({ comparison[c]->name, n, repetitions, percentile(caseSamples.times, 0.5), percentile(caseSamples.times, 0.99),
+							countersPerOp });
+	}
+	return results;
+}
+
+void write_csv(std::ostream &out, const std::vector<Result> &results)
+{
+	out << "name,n,repetitions,median_ns,p99_ns,ns_per_element\n";
+	for (const Result &result : results)
+		out << '"' << result.name << "\"," << result.n << ',' << result.repetitions << ',' << result.medianNs << ','
+			<< result.p99Ns << ',' << result.ns_per_element() << '\n';
+}
+
+void write_json(std::ostream &out, const std::vector<Result> &results)
+{
+	out << "[\n";
+	for (std::size_t i = 0; i < results.size(); i++)
+	{
+		const Result &result = results[i];
+		out << "  {\"name\": \"" << result.name << "\", \"n\": " << result.n << ", \"repetitions\": " << result.repetitions
+			<< ", \"median_ns\": " << result.medianNs << ", \"p99_ns\": " << result.p99Ns
+			<< ", \"ns_per_element\": " << result.ns_per_element();
+		if (!result.countersPerOp.empty())
+			out << ", \"counters_per_op\": \"" << result.countersPerOp << '"';
+		out << '}' << (i + 1 < results.size() ? "," : "") << '\n';
+	}
+	out << "]\n";
+}
+
+/// One chart per op and size, bars on a log scale so a container that is orders of magnitude
+/// slower doesn't flatten all the others to nothing
+void write_charts(std::ostream &out, const std::vector<Result> &results)
+{
+	constexpr double charsPerDecade = 10;
+	std::map<std::pair<std::string, std::size_t>, std::vector<const Result *>> charts;
+	for (const Result &result : results)
+		charts[{ comparison_of(result.name), result.n }].push_back(&result);
+
+	for (const auto &[key, bars] : charts)
+	{
+		int64_t fastest = INT64_MAX;
+		std::size_t longestName = 0;
+		for (const Result *result : bars)
+		{
+			fastest = std::min(fastest, std::max<int64_t>(result->medianNs, 1));
+			longestName = std::max(longestName, result->name.size());
+		}
+		// The fastest bar gets one character, every 10 more are 10x slower
+		out << "----[" << key.first << ", n = " << key.second << ", log scale, 10 # = 10x]----\n";
+		for (const Result *result : bars)
+		{
+			double decades = std::log10((double)std::max<int64_t>(result->medianNs, 1) / (double)fastest);
+			out << std::setw((int)longestName) << std::right << result->name << " | "
+				<< std::string(1 + (std::size_t)std::lround(decades * charsPerDecade), '#') << " (" << result->medianNs << ")\n";
+		}
+		out << '\n';
+	}
+}
+
+/// How much faster the node pool is: every `ADD_ALLOCATORS` case, as the median with one allocator
+/// call per node over the median with the node pool. All three ran interleaved, so they compare.
+void write_pool_speedups(std::ostream &out, const std::vector<Result> &results)
+{
+	const std::string pooledVariant = " (node pool)/";
+	std::map<std::pair<std::string, std::size_t>, int64_t> medians;
+	for (const Result &result : results)
+		medians[{ result.name, result.n }] = result.medianNs;
+
+	bool any = false;
+	for (const Result &pooled : results)
+	{
+		std::size_t variantStart = pooled.name.find(pooledVariant);
+		if (variantStart == std::string::npos || pooled.medianNs <= 0)
+			continue;
+		std::string line;
+		for (const char *allocator : { "std::allocator", "fast_pool_allocator" })
+		{
+			std::string name = pooled.name.substr(0, variantStart) + " (" + allocator + ")/" +
+							   pooled.name.substr(variantStart + pooledVariant.size());
+			auto found = medians.find({ name, pooled.n });
+			if (found == medians.end())
+				continue;
+			std::ostringstream speedup;
+			speedup << std::fixed << std::setprecision(2) << (double)found->second / (double)pooled.medianNs << "x vs " << allocator;
+			line += (line.empty() ? "" : ", ") + speedup.str();
+		}
+		if (line.empty())
+			continue;
+		if (!any)
+			out << "\nnode pool speedup:\n";
+		any = true;
+		out << std::left << std::setw(nameWidth) << pooled.name << std::right << std::setw(10) << pooled.n << "  " << line << '\n';
+	}
+}
+
+/// Reads a CSV written by `write_csv` into (name, n) -> median
+std::map<std::pair<std::string, std::size_t>, int64_t> read_baseline(std::istream &in)
+{
+	std::map<std::pair<std::string, std::size_t>, int64_t> baseline;
+	std::string line;
+	std::getline(in, line);
+	while (std::getline(in, line))
+	{
+		// The name is quoted and never contains a quote itself
+		std::size_t nameEnd = line.find('"', 1);
+		if (line.empty() || line[0] != '"' || nameEnd == std::string::npos)
+			continue;
+		std::string name = line.substr(1, nameEnd - 1);
+		std::istringstream fields(line.substr(nameEnd + 2));
+		std::size_t n = 0, repetitions = 0;
+		int64_t median = 0;
+		char comma;
+		if (fields >> n >> comma >> repetitions >> comma >> median)
+			baseline[{ name, n }] = median;
+	}
+	return baseline;
+}
+
+/// True if `text` is empty or negative, `std::stoull` would wrap "-5" around instead of failing
+bool blank_or_negative(const std::string &text)
+{
+	std::size_t first = text.find_first_not_of(" \t");
+	return first == std::string::npos || text[first] == '-';
+}
+
+/// Positive whole number, throws `std::logic_error` for anything else ("-5", "0", "10abc")
+std::size_t parse_count(const std::string &text)
+{
+	std::size_t end = 0;
+	std::size_t count = blank_or_negative(text) ? 0 : std::stoull(text, &end);
+	if (count == 0 || end != text.size())
+		throw std::invalid_argument(text);
+	return count;
+}
+
+/// Positive number, throws `std::logic_error` for anything else
+double parse_positive(const std::string &text)
+{
+	std::size_t end = 0;
+	double value = blank_or_negative(text) ? 0 : std::stod(text, &end);
+	if (!(value > 0) || end != text.size())
+		throw std::invalid_argument(text);
+	return value;
+}
+
+std::vector<std::size_t> parse_sizes(const std::string &list)
+{
+	std::vector<std::size_t> sizes;
+	std::istringstream in(list);
+	std::string size;
+	while (std::getline(in, size, ','))
+		sizes.push_back(parse_count(size));
+	if (sizes.empty())
+		throw std::invalid_argument(list);
+	return sizes;
+}
+
+int usage()
+{
+	std::cerr << "usage: deque_bench [--sizes 1000,10000,100000] [--repetitions 15] [--filter text]\n"
+				 "                   [--csv file] [--json file] [--baseline file.csv] [--threshold 0.10] [--list]\n"
+				 "                   [--chart] [--trace file] [--make-trace file count]\n";
+	return 2;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::size_t> sizes = { 1000, 10000, 100000 };
+	std::size_t repetitions = 15;
+	std::string filter, csvPath, jsonPath, baselinePath, tracePath;
+	double threshold = 0.10;
+	bool list = false;
+	bool chart = false;
+
+	try
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+			if (arg == "--sizes" && hasValue)
+				sizes = parse_sizes(argv[++i]);
+			else if (arg == "--repetitions" && hasValue)
+				repetitions = parse_count(argv[++i]);
+			else if (arg == "--filter" && hasValue)
+				filter = argv[++i];
+			else if (arg == "--csv" && hasValue)
+				csvPath = argv[++i];
+			else if (arg == "--json" && hasValue)
+				jsonPath = argv[++i];
+			else if (arg == "--baseline" && hasValue)
+				baselinePath = argv[++i];
+			else if (arg == "--threshold" && hasValue)
+				threshold = parse_positive(argv[++i]);
+			else if (arg == "--list")
+				list = true;
+			else if (arg == "--chart")
+				chart = true;
+			else if (arg == "--trace" && hasValue)
+				tracePath = argv[++i];
+			else if (arg == "--make-trace" && i + 2 < argc)
+			{
+				std::size_t count = parse_count(argv[i + 2]);
+				std::ofstream out(argv[i + 1]);
+				write_trace(out, make_mixed_trace(count));
+				return 0;
+			}
+			else
+				return usage();
+		}
+	}
+	catch (const std::logic_error &)
+	{
+		// Not a number, negative, zero or out of range
+		return usage();
+	}
+
+	std::unique_ptr<perf_counters> hardwareCounters;
+	if (std::getenv("STABLE_DEQUE_PERF_COUNTERS") != nullptr)
+	{
+		hardwareCounters = std::make_unique<perf_counters>();
+		if (hardwareCounters->available())
+			counters = hardwareCounters.get();
+		else
+			std::cerr << "STABLE_DEQUE_PERF_COUNTERS is set, but no hardware counter could be opened "
+						 "(not Linux, perf_event_paranoid, or no PMU in this VM/container)\n";
+	}
+
+#if defined(__GLIBC__)
+	// Keep freed memory in the heap. By default glibc hands the megabytes a case frees back to the
+	// OS (trimming the top of the heap, unmapping big blocks), and the next case page-faults it in
+	// again, so a case's time depended on which cases ran before it. 32 MiB is the largest mmap
+	// threshold glibc accepts on 64-bit.
+	mallopt(M_MMAP_THRESHOLD, 32 * 1024 * 1024);
+	mallopt(M_TRIM_THRESHOLD, INT_MAX);
+#endif
+
+	std::vector<Case> cases;
+	if (tracePath.empty())
+	{
+		cases = make_cases();
+	}
+	else
+	{
+		auto trace = std::make_shared<Trace>();
+		std::ifstream in(tracePath);
+		if (!in || !read_trace(in, *trace))
+		{
+			std::cerr << "can't read trace " << tracePath << '\n';
+			return 2;
+		}
+		std::string name = tracePath.substr(tracePath.find_last_of("/\\") + 1);
+		cases = make_trace_cases(trace, "trace:" + name);
+		sizes = { std::max<std::size_t>(trace->size(), 1) };
+	}
+	std::erase_if(cases, [&](const Case &benchCase) { return benchCase.name.find(filter) == std::string::npos; });
+	if (list)
+	{
+		for (const Case &benchCase : cases)
+			std::cout << benchCase.name << '\n';
+		return 0;
+	}
+
+	// Comparisons run in the order their first case was registered
+	std::vector<std::string> comparisonOrder;
+	std::map<std::string, std::vector<const Case *>> comparisons;
+	for (const Case &benchCase : cases)
+	{
+		std::vector<const Case *> &comparison = comparisons[comparison_of(benchCase.name)];
+		if (comparison.empty())
+			comparisonOrder.push_back(comparison_of(benchCase.name));
+		comparison.push_back(&benchCase);
+	}
+
+	std::vector<Result> results;
+	std::cout << std::left << std::setw(nameWidth) << "case" << std::right << std::setw(10) << "n" << std::setw(14) << "median ns"
+			  << std::setw(14) << "p99 ns" << std::setw(12) << "ns/elem" << '\n';
+	for (std::size_t n : sizes)
+		for (const std::string &name : comparisonOrder)
+		{
+			std::vector<const Case *> comparison;
+			for (const Case *benchCase : comparisons[name])
+				if (n <= benchCase->maxN)
+					comparison.push_back(benchCase);
+			if (comparison.empty())
+				continue;
+			std::vector<Result> compared;
+			try
+			{
+				compared = run_comparison(comparison, n, repetitions);
+			}
+			catch (const std::exception &error)
+			{
+				std::cerr << error.what() << '\n';
+				return 2;
+			}
+			for (const Result &result : compared)
+			{
+				std::cout << std::left << std::setw(nameWidth) << result.name << std::right << std::setw(10) << result.n << std::setw(14)
+						  << result.medianNs << std::setw(14) << result.p99Ns << std::setw(12) << std::fixed << std::setprecision(2)
+						  << result.ns_per_element();
+				if (!result.countersPerOp.empty())
+					std::cout << "  " << result.countersPerOp << " per op";
+				std::cout << '\n';
+				results.push_back(result);
+			}
+		}
+
+	write_pool_speedups(std::cout, results);
+	if (chart)
+	{
+		std::cout << '\n';
+		write_charts(std::cout, results);
+	}
+	if (!csvPath.empty())
+	{
+		std::ofstream out(csvPath);
+		write_csv(out, results);
+	}
+	if (!jsonPath.empty())
+	{
+		std::ofstream out(jsonPath);
+		write_json(out, results);
+	}
+
+	if (baselinePath.empty())
+		return 0;
+	std::ifstream in(baselinePath);
+	if (!in)
+	{
+		std::cerr << "can't open baseline " << baselinePath << '\n';
+		return 2;
+	}
+	auto baseline = read_baseline(in);
+	int regressions = 0;
+	std::cout << "\nagainst " << baselinePath << " (threshold " << threshold * 100 << "%):\n";
+	for (const Result &result : results)
+	{
+		auto found = baseline.find({ result.name, result.n });
+		if (found == baseline.end() || found->second <= 0)
+			continue;
+		double ratio = (double)result.medianNs / (double)found->second;
+		bool regressed = ratio > 1.0 + threshold;
+		regressions += regressed;
+		std::cout << std::left << std::setw(nameWidth) << result.name << std::right << std::setw(10) << result.n << std::setw(10)
+				  << std::fixed << std::setprecision(2) << ratio << 'x' << (regressed ? "  REGRESSION" : "") << '\n';
+	}
+	std::cout << regressions << " regression(s)\n";
+	return regressions > 0 ? 1 : 0;
+}
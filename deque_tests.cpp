@@ -1,22 +1,89 @@
+#include "concurrent_stable_deque.h"
+#include "intrusive_stable_deque.h"
 #include "stable_deque.h"
+#include "stable_deque_snapshot.h"
 #include "vector_stable_deque.h"
+#include "work_stealing_deque.h"
 
-#include <boost/container/stable_vector.hpp>
 #include <boost/pool/pool_alloc.hpp>
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
 #include <deque>
-#include <fstream>
 #include <gtest/gtest.h>
-#include <iostream>
-#include <string>
-#include <typeinfo>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <ranges>
+#include <sstream>
+#include <thread>
 #include <vector>
 
-using namespace boost::container;
 using namespace std::chrono;
 using namespace boost;
 
+struct unpooled_options : stable_deque_options
+{
+	static constexpr bool pooled_nodes = false;
+};
+
+// Tiny blocks, so splits and merges happen all the time
+struct blocked_options : stable_deque_options
+{
+	static constexpr std::size_t position_block_size = 4;
+};
+
+template<typename T>
+using blocked_stable_deque = stable_deque<T, std::allocator<T>, blocked_options>;
+
+struct ordered_options : stable_deque_options
+{
+	static constexpr bool ordered_node_placement = true;
+};
+
+template<typename T>
+using ordered_stable_deque = stable_deque<T, std::allocator<T>, ordered_options>;
+
+struct slot_options : stable_deque_options
+{
+	static constexpr bool slot_positions = true;
+};
+
+template<typename T>
+using slot_stable_deque = stable_deque<T, std::allocator<T>, slot_options>;
+
+struct stats_options : stable_deque_options
+{
+	static constexpr bool collect_stats = true;
+};
+
+struct tombstone_options : stable_deque_options
+{
+	static constexpr bool tombstone_erase = true;
+};
+
+template<typename T>
+using tombstone_stable_deque = stable_deque<T, std::allocator<T>, tombstone_options>;
+
+template<typename T>
+using tombstone_vector_stable_deque = vector_stable_deque<T, std::allocator<T>, tombstone_options>;
+
+struct blocked_tombstone_options : blocked_options
+{
+	static constexpr bool tombstone_erase = true;
+};
+
+struct slot_tombstone_options : slot_options
+{
+	static constexpr bool tombstone_erase = true;
+};
+
 // Ensure gtest works
 TEST(StableDequeTest, GTest)
 {
@@ -77,188 +144,1743 @@ TEST(StableDequeTest, Smoke)
 	EXPECT_LT(iter1, iter2);
 }
 
-#define PREAMBLE(N) \
-	std::ifstream stream(std::string(ROOT_DIR)+std::string("/magic_data.txt")); \
-	char firstChar{}; \
-	stream.get(firstChar); \
-	std::string firstCharString{}; \
-	firstCharString += firstChar; \
-	T magicData = T(std::stoi(firstCharString)); \
-	Container container{}; \
-	constexpr std::size_t count = N;
+TEST(StableDequeTest, FifoChurn)
+{
+	// push_back + erase(begin()) never touches the left side, so every erase lands on the
+	// node next to `middle`
+	stable_deque<int> sd;
+	for (int i = 0; i < 100; i++)
+		sd.push_back(i);
+	auto iter50 = sd.begin() + 50;
+
+	for (int i = 100; i < 150; i++)
+	{
+		sd.push_back(i);
+		sd.erase(sd.begin());
+	}
+
+	EXPECT_EQ(sd.size(), 100);
+	EXPECT_EQ(*iter50, 50);
+	EXPECT_EQ(*sd.begin(), 50);
+	for (int i = 0; i < sd.size(); i++)
+		EXPECT_EQ(sd[i], i + 50);
+
+	// Mirror image: push_front + erase(end() - 1) drains the left side from `middle`
+	stable_deque<int> sd2;
+	for (int i = 0; i < 100; i++)
+		sd2.push_front(i);
+	auto iter50_2 = sd2.begin() + 49;
+
+	for (int i = 100; i < 150; i++)
+	{
+		sd2.push_front(i);
+		sd2.erase(sd2.end() - 1);
+	}
+
+	EXPECT_EQ(sd2.size(), 100);
+	EXPECT_EQ(*iter50_2, 50);
+	for (int i = 0; i < sd2.size(); i++)
+		EXPECT_EQ(sd2[i], 149 - i);
+
+	// Mixing in pushes on the drained side must still place nodes correctly
+	sd2.push_back(-1);
+	sd2.push_front(-2);
+	EXPECT_EQ(sd2[0], -2);
+	EXPECT_EQ(sd2[1], 149);
+	EXPECT_EQ(sd2[sd2.size() - 1], -1);
+	EXPECT_EQ(*iter50_2, 50);
+}
+
+// Mirror random end/middle inserts and erases into a `std::deque` and make sure both the
+// contents and previously taken iterators agree with it
+template<typename Container>
+void check_random_ops()
+{
+	Container sd;
+	std::deque<int> reference;
+	std::list<std::pair<int, decltype(sd.begin())>> tracked;
+	std::mt19937 rng(42);
+	int nextValue = 0;
+
+	for (int step = 0; step < 4000; step++)
+	{
+		int64_t size = (int64_t)reference.size();
+		int op = rng() % 7;
+		if (op == 0)
+		{
+			sd.push_front(nextValue);
+			reference.push_front(nextValue++);
+		}
+		else if (op == 1)
+		{
+			sd.push_back(nextValue);
+			reference.push_back(nextValue++);
+		}
+		else if (op == 2 || size == 0)
+		{
+			int64_t index = rng() % (size + 1);
+			sd.insert(sd.begin() + index, nextValue);
+			reference.insert(reference.begin() + index, nextValue++);
+			if (rng() % 8 == 0)
+				tracked.push_back({ reference[index], sd.begin() + index });
+		}
+		else if (op == 6)
+		{
+			int64_t first = rng() % size;
+			int64_t last = first + rng() % std::min<int64_t>(size - first + 1, 8);
+			tracked.remove_if([&](const auto &entry) {
+				return std::find(reference.begin() + first, reference.begin() + last, entry.first) != reference.begin() + last;
+			});
+			sd.erase(sd.begin() + first, sd.begin() + last);
+			reference.erase(reference.begin() + first, reference.begin() + last);
+		}
+		else
+		{
+			int64_t index = op == 3 ? 0 : op == 4 ? size - 1 : rng() % size;
+			int value = reference[index];
+			tracked.remove_if([&](const auto &entry) { return entry.first == value; });
+			sd.erase(sd.begin() + index);
+			reference.erase(reference.begin() + index);
+		}
+	}
+
+	ASSERT_EQ(sd.size(), reference.size());
+	for (int64_t i = 0; i < (int64_t)reference.size(); i++)
+		EXPECT_EQ(sd[i], reference[i]);
+	for (auto &[value, iter] : tracked)
+		EXPECT_EQ(*iter, value);
+}
+
+TEST(StableDequeTest, RandomOps)
+{
+	check_random_ops<stable_deque<int>>();
+	check_random_ops<blocked_stable_deque<int>>();
+	check_random_ops<ordered_stable_deque<int>>();
+	check_random_ops<slot_stable_deque<int>>();
+	check_random_ops<tombstone_stable_deque<int>>();
+	check_random_ops<stable_deque<int, std::allocator<int>, blocked_tombstone_options>>();
+	check_random_ops<stable_deque<int, std::allocator<int>, slot_tombstone_options>>();
+	check_random_ops<tombstone_vector_stable_deque<int>>();
+}
+
+// `pop_front()`/`pop_back()` bypass `erase_inner()`, so drain both ends across `middle` and check
+// that indexing, iterators taken earlier and the element addresses still agree with a `std::deque`
+template<typename Container>
+void check_pop_ends()
+{
+	Container sd;
+	std::deque<int> reference;
+	std::map<int, const int *> addresses;
+	std::mt19937 rng(7);
+	int nextValue = 0;
+
+	for (int step = 0; step < 4000; step++)
+	{
+		int op = rng() % 8;
+		if (op < 2)
+		{
+			addresses[nextValue] = &sd.emplace_front(nextValue);
+			reference.push_front(nextValue++);
+		}
+		else if (op < 4)
+		{
+			addresses[nextValue] = &sd.emplace_back(nextValue);
+			reference.push_back(nextValue++);
+		}
+		else if (op == 4 && !reference.empty())
+		{
+			int64_t index = rng() % (reference.size() + 1);
+			addresses[nextValue] = &*sd.insert(sd.begin() + index, nextValue);
+			reference.insert(reference.begin() + index, nextValue++);
+		}
+		else if (op == 5 && !reference.empty())
+		{
+			ASSERT_EQ(sd.front(), reference.front());
+			addresses.erase(reference.front());
+			sd.pop_front();
+			reference.pop_front();
+		}
+		else if (op == 6 && !reference.empty())
+		{
+			ASSERT_EQ(sd.back(), reference.back());
+			addresses.erase(reference.back());
+			sd.pop_back();
+			reference.pop_back();
+		}
+		else
+		{
+			std::optional<int> value = rng() % 2 ? sd.try_pop_front() : sd.try_pop_back();
+			ASSERT_EQ(value.has_value(), !reference.empty());
+			if (value)
+			{
+				ASSERT_TRUE(*value == reference.front() || *value == reference.back());
+				if (*value == reference.front())
+					reference.pop_front();
+				else
+					reference.pop_back();
+				addresses.erase(*value);
+			}
+		}
+
+		ASSERT_EQ(sd.size(), reference.size());
+		if (!reference.empty())
+		{
+			EXPECT_EQ(sd.front(), reference.front());
+			EXPECT_EQ(sd.back(), reference.back());
+			EXPECT_EQ(*(sd.end() - 1), reference.back());
+		}
+		if (step % 100 == 0)
+		{
+			for (int64_t i = 0; i < (int64_t)reference.size(); i++)
+				ASSERT_EQ(sd[i], reference[i]);
+			for (auto [value, address] : addresses)
+				ASSERT_EQ(*address, value);
+		}
+	}
+
+	while (!reference.empty())
+	{
+		EXPECT_EQ(*sd.try_pop_back(), reference.back());
+		reference.pop_back();
+	}
+	EXPECT_FALSE(sd.try_pop_front());
+	EXPECT_FALSE(sd.try_pop_back());
+	EXPECT_TRUE(sd.empty());
+}
+
+TEST(StableDequeTest, PopEnds)
+{
+	check_pop_ends<stable_deque<int>>();
+	check_pop_ends<blocked_stable_deque<int>>();
+	check_pop_ends<ordered_stable_deque<int>>();
+	check_pop_ends<slot_stable_deque<int>>();
+	check_pop_ends<tombstone_stable_deque<int>>();
+
+	// Move-only elements come out of `try_pop_*` by move
+	stable_deque<std::unique_ptr<int>> pointers;
+	pointers.push_back(std::make_unique<int>(1));
+	pointers.push_front(std::make_unique<int>(0));
+	EXPECT_EQ(**pointers.try_pop_back(), 1);
+	EXPECT_EQ(**pointers.try_pop_front(), 0);
+	EXPECT_FALSE(pointers.try_pop_front());
+}
+
+TEST(StableDequeTest, NodePool)
+{
+	stable_deque<int> sd;
+	for (int i = 0; i < 1000; i++)
+		sd.push_back(i);
+	int *address500 = &sd[500];
 
-#define START_PROFILE() \
-	auto start = std::chrono::high_resolution_clock::now(); 
+	// Freed nodes are handed out again before new chunks are touched
+	int *erasedAddress = &sd[10];
+	sd.erase(sd.begin() + 10);
+	sd.push_front(-1);
+	EXPECT_EQ(&sd[0], erasedAddress);
+	EXPECT_EQ(&sd[500], address500);
+	EXPECT_EQ(*address500, 500);
 
+	vector_stable_deque<int> vsd;
+	for (int i = 0; i < 100; i++)
+		vsd.push_back(i);
+	erasedAddress = &vsd[0];
+	vsd.erase(vsd.begin());
+	vsd.push_back(100);
+	EXPECT_EQ(&vsd[99], erasedAddress);
+	for (int i = 0; i < vsd.size(); i++)
+		EXPECT_EQ(vsd[i], i + 1);
 
-#define END_PROFILE() \
-	auto end = std::chrono::high_resolution_clock::now(); \
-	auto elapsed = end - start; \
-	std::cout << "(n = " << std::to_string(count) << ") " << __FUNCTION__ << "_profile<" << type_prompt << ">(...): " << elapsed.count() << '\n'; \
-	return (int64_t)elapsed.count();
+	// Unpooled and custom allocators still work
+	stable_deque<int, fast_pool_allocator<int>, unpooled_options> unpooled;
+	for (int i = 0; i < 100; i++)
+		unpooled.push_front(i);
+	for (int i = 0; i < 50; i++)
+		unpooled.erase(unpooled.begin() + 25);
+	EXPECT_EQ(unpooled.size(), 50);
+	EXPECT_EQ(unpooled[24], 75);
+	EXPECT_EQ(unpooled[25], 24);
+}
 
-template<typename T, typename Container>
-int64_t push_front_profile(std::string type_prompt)
+TEST(StableDequeTest, OrderedPlacement)
 {
-	PREAMBLE(5000)
-	START_PROFILE()
-	for (auto i = 0; i < count; i++)
+	// Counts neighbours that are also neighbours in memory (same stride as the first pair)
+	auto adjacentPairs = [](auto &container) {
+		std::ptrdiff_t stride = (char *)&container[1] - (char *)&container[0];
+		int adjacent = 0;
+		for (int i = 0; i + 1 < container.size(); i++)
+			adjacent += (char *)&container[i + 1] - (char *)&container[i] == stride;
+		return adjacent;
+	};
+
+	ordered_stable_deque<int> ordered;
+	stable_deque<int> unordered;
+	for (int i = 0; i < 5000; i++)
 	{
-		container.insert(container.begin(), magicData);
+		ordered.push_back(i);
+		ordered.push_front(-i - 1);
+		unordered.push_back(i);
+		unordered.push_front(-i - 1);
 	}
-	END_PROFILE()
+	// Only chunk borders break the runs. Without it the front half runs backwards, interleaved with the back half.
+	EXPECT_GT(adjacentPairs(ordered), 9900);
+	EXPECT_LT(adjacentPairs(unordered), 5100);
+	EXPECT_GT((char *)&ordered[1] - (char *)&ordered[0], 0);
+
+	// Once the chunk runs out, erased nodes are reused before growing
+	int *erasedAddress = &ordered[7000];
+	ordered.erase(ordered.begin() + 7000);
+	while (ordered.size() < 20000)
+		ordered.push_back(0);
+	bool reused = false;
+	for (int i = 0; i < ordered.size(); i++)
+		reused |= &ordered[i] == erasedAddress;
+	EXPECT_TRUE(reused);
 }
 
-template<typename T, typename Container>
-int64_t push_back_profile(std::string type_prompt)
+template<typename Container>
+void check_range_insert()
 {
-	PREAMBLE(5000)
-	START_PROFILE()
-	for (auto i = 0; i < count; i++)
+	Container container;
+	std::deque<int> reference;
+	for (int i = 0; i < 20; i++)
 	{
-		container.push_back(magicData);
+		container.push_back(i);
+		container.push_front(-i - 1);
 	}
-	END_PROFILE()
+	for (int i = 0; i < container.size(); i++)
+		reference.push_back(container[i]);
+	auto iter0 = container.begin() + 20;
+
+	std::vector<int> values{ 100, 101, 102, 103, 104 };
+	for (int64_t index : { 0, 5, 20, 30, 40 })
+	{
+		auto inserted = container.insert(container.begin() + index, values.begin(), values.end());
+		reference.insert(reference.begin() + index, values.begin(), values.end());
+		EXPECT_EQ(*inserted, 100);
+	}
+
+	std::list<int> list{ 7, 8, 9 };
+	container.insert(container.begin() + 3, list.begin(), list.end());
+	reference.insert(reference.begin() + 3, list.begin(), list.end());
+
+	// Single pass input
+	std::istringstream stream("200 201 202");
+	container.insert(container.end() - 10, std::istream_iterator<int>(stream), std::istream_iterator<int>());
+	reference.insert(reference.end() - 10, { 200, 201, 202 });
+
+	container.insert(container.begin() + 50, 4, -7);
+	reference.insert(reference.begin() + 50, 4, -7);
+	container.insert(container.begin() + 1, values.begin(), values.begin());
+
+	container.append_range(values);
+	reference.insert(reference.end(), values.begin(), values.end());
+	container.prepend_range(std::views::iota(300, 310));
+	reference.insert(reference.begin(), std::views::iota(300).begin(), std::views::iota(300).begin() + 10);
+
+	ASSERT_EQ(container.size(), reference.size());
+	for (int i = 0; i < reference.size(); i++)
+		EXPECT_EQ(container[i], reference[i]);
+	EXPECT_EQ(*iter0, 0);
+}
+
+TEST(StableDequeTest, RangeInsert)
+{
+	check_range_insert<stable_deque<int>>();
+	check_range_insert<vector_stable_deque<int>>();
+	check_range_insert<blocked_stable_deque<int>>();
+	check_range_insert<slot_stable_deque<int>>();
+
+	// Inserting into an empty deque has to start the left side just like `insert`
+	stable_deque<int> empty;
+	std::vector<int> values{ 1, 2, 3 };
+	empty.insert(empty.begin(), values.begin(), values.end());
+	empty.push_front(0);
+	empty.push_back(4);
+	for (int i = 0; i < 5; i++)
+		EXPECT_EQ(empty[i], i);
 }
 
-template<typename T, typename Container>
-int64_t erase_front_profile(std::string type_prompt)
+template<typename Container>
+void check_range_erase()
 {
-	PREAMBLE(5000)
-	for (auto i = 0; i < count; i++)
+	Container container;
+	std::deque<int> reference;
+	for (int i = 0; i < 50; i++)
 	{
-		container.insert(container.begin(), magicData);
+		container.push_back(i);
+		container.push_front(-i - 1);
 	}
+	for (int i = 0; i < container.size(); i++)
+		reference.push_back(container[i]);
+	auto iterLast = container.end() - 1;
 
-	START_PROFILE()
-	for (auto i = 0; i < count; i++)
+	// Left only, across `middle`, right only, both ends
+	for (auto [first, last] : { std::pair{ 5, 10 }, std::pair{ 30, 60 }, std::pair{ 45, 50 }, std::pair{ 0, 3 }, std::pair{ 40, 40 } })
 	{
-		container.erase(container.begin());
+		auto next = container.erase(container.begin() + first, container.begin() + last);
+		reference.erase(reference.begin() + first, reference.begin() + last);
+		EXPECT_EQ(*next, reference[first]);
 	}
-	END_PROFILE()
+	container.erase(container.end() - 4, container.end() - 1);
+	reference.erase(reference.end() - 4, reference.end() - 1);
+	container.push_front(1000);
+	reference.push_front(1000);
+
+	EXPECT_EQ(erase_if(container, [](int value) { return value % 3 == 0; }), std::erase_if(reference, [](int value) { return value % 3 == 0; }));
+	container.push_front(1001);
+	reference.push_front(1001);
+	container.insert(container.begin() + 20, 1002);
+	reference.insert(reference.begin() + 20, 1002);
+
+	ASSERT_EQ(container.size(), reference.size());
+	for (int i = 0; i < reference.size(); i++)
+		EXPECT_EQ(container[i], reference[i]);
+	EXPECT_EQ(*iterLast, 49);
+
+	container.resize(10);
+	container.resize(15, 7);
+	container.resize(17);
+	reference.resize(10);
+	reference.resize(15, 7);
+	reference.resize(17);
+	ASSERT_EQ(container.size(), reference.size());
+	for (int i = 0; i < reference.size(); i++)
+		EXPECT_EQ(container[i], reference[i]);
+
+	container.clear();
+	EXPECT_EQ(container.size(), 0);
+	EXPECT_EQ(container.begin(), container.end());
+	container.push_back(1);
+	container.push_front(0);
+	EXPECT_EQ(container[0], 0);
+	EXPECT_EQ(container[1], 1);
+}
+
+TEST(StableDequeTest, RangeErase)
+{
+	check_range_erase<stable_deque<int>>();
+	check_range_erase<vector_stable_deque<int>>();
+	check_range_erase<blocked_stable_deque<int>>();
+	check_range_erase<slot_stable_deque<int>>();
 }
 
-template<typename T, typename Container>
-int64_t erase_back_profile(std::string type_prompt)
+static_assert(std::random_access_iterator<stable_deque<int>::iterator>);
+static_assert(std::random_access_iterator<stable_deque<int>::const_iterator>);
+static_assert(std::random_access_iterator<blocked_stable_deque<int>::iterator>);
+static_assert(std::random_access_iterator<vector_stable_deque<int>::iterator>);
+static_assert(std::random_access_iterator<vector_stable_deque<int>::const_iterator>);
+static_assert(std::ranges::random_access_range<stable_deque<int>>);
+static_assert(std::ranges::random_access_range<const vector_stable_deque<int>>);
+static_assert(std::sortable<stable_deque<int>::iterator>);
+
+template<typename Container>
+void check_standard_algorithms()
 {
-	// Skip deque<T> since `end()-1` hits an assert (a MSVC bug?)
-	if constexpr (std::same_as<std::deque<T>, Container>)
-		return 0;
+	// Spread the values over both sides of `middle`
+	Container container;
+	std::deque<int> reference;
+	std::mt19937 rng(7);
+	for (int i = 0; i < 500; i++)
+	{
+		int value = (int)(rng() % 1000);
+		if (i % 2 == 0)
+			container.push_back(value);
+		else
+			container.push_front(value);
+	}
+	for (int value : container)
+		reference.push_back(value);
+
+	auto iter0 = container.begin() + 250;
+	int *address0 = &*iter0;
+
+	// Ordering and distance across the left/right border
+	EXPECT_EQ(container.end() - container.begin(), (std::ptrdiff_t)container.size());
+	EXPECT_EQ(container.begin() - container.end(), -(std::ptrdiff_t)container.size());
+	for (int left : { 0, 100, 249, 250, 251, 499 })
+	{
+		for (int right : { 0, 100, 249, 250, 251, 499, 500 })
+		{
+			auto l = container.begin() + left;
+			auto r = container.begin() + right;
+			EXPECT_EQ(l < r, left < right);
+			EXPECT_EQ(l > r, left > right);
+			EXPECT_EQ(l <= r, left <= right);
+			EXPECT_EQ(l >= r, left >= right);
+			EXPECT_EQ(r - l, right - left);
+		}
+	}
+
+	// Postfix returns the old position
+	auto iter = container.begin();
+	EXPECT_EQ(iter++, container.begin());
+	EXPECT_EQ(iter, container.begin() + 1);
+	EXPECT_EQ(iter--, container.begin() + 1);
+	EXPECT_EQ(iter, container.begin());
 
-	PREAMBLE(5000)
-	for (auto i = 0; i < count; i++)
+	std::sort(container.begin(), container.end());
+	std::sort(reference.begin(), reference.end());
+	EXPECT_TRUE(std::equal(container.begin(), container.end(), reference.begin(), reference.end()));
+	// Sorting moves values, not nodes
+	EXPECT_EQ(&*iter0, address0);
+
+	const Container &constContainer = container;
+	for (int value : { -1, 0, 17, 500, 999, 1000 })
 	{
-		container.push_back(magicData);
+		EXPECT_EQ(std::lower_bound(constContainer.begin(), constContainer.end(), value) - constContainer.begin(),
+			std::lower_bound(reference.begin(), reference.end(), value) - reference.begin());
+		EXPECT_EQ(std::ranges::upper_bound(constContainer, value) - constContainer.cbegin(),
+			std::ranges::upper_bound(reference, value) - reference.begin());
 	}
 
-	START_PROFILE()
-	for (int64_t i = count-1; i >= 0; i--)
+	std::ranges::sort(container, std::greater<>());
+	EXPECT_TRUE(std::equal(container.rbegin(), container.rend(), reference.begin(), reference.end()));
+	EXPECT_TRUE(std::equal(constContainer.crbegin(), constContainer.crend(), reference.begin(), reference.end()));
+	EXPECT_EQ(std::accumulate(constContainer.cbegin(), constContainer.cend(), 0), std::accumulate(reference.begin(), reference.end(), 0));
+
+	typename Container::const_iterator constIter = container.begin();
+	EXPECT_EQ(constIter, container.cbegin());
+	typename Container::iterator defaulted;
+	defaulted = container.begin() + 3;
+	EXPECT_EQ(defaulted[1], constContainer[4]);
+}
+
+TEST(StableDequeTest, StandardAlgorithms)
+{
+	check_standard_algorithms<stable_deque<int>>();
+	check_standard_algorithms<blocked_stable_deque<int>>();
+	check_standard_algorithms<vector_stable_deque<int>>();
+}
+
+template<typename Container>
+void check_traversal()
+{
+	Container container;
+	container.for_each([](int &) { FAIL(); });
+	container.for_each_segment([](auto) { FAIL(); });
+
+	std::vector<int> reference;
+	for (int i = 0; i < 3000; i++)
 	{
-		container.erase(container.end() - 1);
+		if (i % 3 == 0)
+			container.push_front(i);
+		else
+			container.push_back(i);
 	}
-	END_PROFILE()
+	for (int value : container)
+		reference.push_back(value);
+
+	std::vector<int> visited;
+	container.for_each([&](int &value) { visited.push_back(value); value++; });
+	EXPECT_EQ(visited, reference);
+
+	visited.clear();
+	const Container &constContainer = container;
+	int segments = 0;
+	constContainer.for_each_segment([&](auto segment) {
+		static_assert(std::ranges::random_access_range<decltype(segment)>);
+		EXPECT_FALSE(segment.empty());
+		segments++;
+		for (const int &value : segment)
+			visited.push_back(value - 1);
+	});
+	EXPECT_EQ(visited, reference);
+	EXPECT_GE(segments, 1);
+
+	visited.clear();
+	constContainer.for_each([&](const int &value) { visited.push_back(value - 1); });
+	EXPECT_EQ(visited, reference);
+}
+
+TEST(StableDequeTest, Traversal)
+{
+	check_traversal<stable_deque<int>>();
+	check_traversal<blocked_stable_deque<int>>();
+	check_traversal<vector_stable_deque<int>>();
 }
 
-struct BigData
+// Counts how a value gets into the container
+struct Tracked
 {
-	constexpr static std::size_t size = 512;
-	std::array<int, size> data{};
-	BigData(int val)
+	static inline int copies = 0;
+	static inline int moves = 0;
+
+	int value = 0;
+	Tracked(int value) : value(value)
+	{
+	}
+	Tracked(int a, int b) : value(a + b)
+	{
+	}
+	Tracked(const Tracked &other) : value(other.value)
+	{
+		copies++;
+	}
+	Tracked(Tracked &&other) noexcept : value(other.value)
 	{
-		std::fill(data.begin(), data.end(), val);
+		moves++;
 	}
 };
 
-struct ASCIIBarChartGenerator
+template<typename Container>
+void check_emplace_and_move()
 {
-private:
-	std::vector<std::pair<std::string, int64_t>> title_and_val{};
-	int64_t step_count = 100;
-public:
-	ASCIIBarChartGenerator()
+	Container container;
+	Tracked::copies = Tracked::moves = 0;
+
+	container.emplace_back(1);
+	container.emplace_front(0);
+	auto iter = container.emplace(container.begin() + 1, 2, 3);
+	EXPECT_EQ(Tracked::copies, 0);
+	EXPECT_EQ(Tracked::moves, 0);
+	EXPECT_EQ((*iter).value, 5);
+
+	Tracked value(7);
+	container.push_back(std::move(value));
+	container.push_front(std::move(value));
+	container.insert(container.begin() + 2, std::move(value));
+	EXPECT_EQ(Tracked::copies, 0);
+	EXPECT_EQ(Tracked::moves, 3);
+
+	container.push_back(value);
+	EXPECT_EQ(Tracked::copies, 1);
+
+	int expected[] = { 7, 0, 7, 5, 1, 7, 7 };
+	ASSERT_EQ(container.size(), std::size(expected));
+	for (int i = 0; i < container.size(); i++)
+		EXPECT_EQ(container[i].value, expected[i]);
+}
+
+TEST(StableDequeTest, EmplaceAndMove)
+{
+	check_emplace_and_move<stable_deque<Tracked>>();
+	check_emplace_and_move<vector_stable_deque<Tracked>>();
+}
+
+// Neither default constructible nor copyable
+struct MoveOnly
+{
+	static inline int constructions = 0;
+
+	std::unique_ptr<int> value;
+	explicit MoveOnly(int value) : value(std::make_unique<int>(value))
 	{
+		constructions++;
 	}
-	ASCIIBarChartGenerator(std::string title, int64_t timepoint)
+	MoveOnly(MoveOnly &&) = default;
+};
+
+template<typename Container>
+void check_end_node_holds_no_t()
+{
+	MoveOnly::constructions = 0;
 	{
-		title_and_val.push_back({ title, timepoint });
+		Container empty;
+		EXPECT_EQ(empty.size(), 0);
+		EXPECT_EQ(empty.begin(), empty.end());
 	}
-	ASCIIBarChartGenerator& operator()(std::string title, int64_t timepoint)
+	EXPECT_EQ(MoveOnly::constructions, 0);
+
+	Container container;
+	container.emplace_back(1);
+	container.push_front(MoveOnly(0));
+	container.emplace(container.end(), 2);
+	EXPECT_EQ(MoveOnly::constructions, 3);
+	for (int i = 0; i < container.size(); i++)
+		EXPECT_EQ(*container[i].value, i);
+}
+
+TEST(StableDequeTest, EndNodeHoldsNoT)
+{
+	check_end_node_holds_no_t<stable_deque<MoveOnly>>();
+	check_end_node_holds_no_t<vector_stable_deque<MoveOnly>>();
+}
+
+template<typename Container>
+void check_stats_bookkeeping()
+{
+	Container container;
+	for (int i = 0; i < 1000; i++)
+		container.push_back(i);
+	stable_deque_stats stats = container.stats();
+	EXPECT_EQ(stats.node_allocations, 1000);
+	EXPECT_EQ(stats.node_frees, 0);
+	EXPECT_GT(stats.deque_block_allocations, 0);
+	EXPECT_GT(stats.deque_map_reallocations, 0);
+
+	container.reset_stats();
+	container.insert(container.begin() + 10, -1);
+	container.erase(container.begin() + 500);
+	stats = container.stats();
+	EXPECT_EQ(stats.node_allocations, 1);
+	EXPECT_EQ(stats.node_frees, 1);
+	EXPECT_GT(stats.fix_up_nodes, 0);
+	EXPECT_LE(stats.max_fix_up_nodes, stats.fix_up_nodes);
+	EXPECT_EQ(container[10], -1);
+	EXPECT_EQ(container[500], 500);
+}
+
+TEST(StableDequeTest, Stats)
+{
+	check_stats_bookkeeping<stable_deque<int, std::allocator<int>, stats_options>>();
+	check_stats_bookkeeping<vector_stable_deque<int, std::allocator<int>, stats_options>>();
+
+	// The shorter run is renumbered: inserting right after the front touches the nodes before it,
+	// and erasing next to `middle` is absorbed by the side bias
+	stable_deque<int, std::allocator<int>, stats_options> container;
+	for (int i = 0; i < 100; i++)
+		container.push_back(i);
+	container.reset_stats();
+	container.insert(container.begin() + 3, -1);
+	EXPECT_EQ(container.stats().max_fix_up_nodes, 3);
+	container.reset_stats();
+	container.erase(container.begin());
+	EXPECT_EQ(container.stats().fix_up_nodes, 0);
+	container.pop_front();
+	container.pop_back();
+	EXPECT_EQ(container.stats().fix_up_nodes, 0);
+	EXPECT_EQ(container.stats().node_frees, 3);
+
+	// Walking from the left side into the right one switches sides once
+	for (int i = 0; i < 10; i++)
+		container.push_front(i);
+	container.reset_stats();
+	int sum = 0;
+	for (int value : container)
+		sum += value;
+	EXPECT_EQ(container.stats().iterator_side_switches, 1);
+	EXPECT_GT(sum, 0);
+}
+
+// Node storage taken from the pool: what the elements use plus what sits idle
+std::size_t pool_bytes(const stable_deque_memory_usage &usage)
+{
+	return usage.elements + usage.node_overhead + usage.tombstones + usage.idle_nodes + usage.pool_overhead;
+}
+
+// `reserve()` covers a burst without new chunks, `shrink_to_fit()` gives back only chunks nobody uses
+template<typename Container>
+void check_memory_footprint()
+{
+	Container container;
+	container.reserve(1000);
+	stable_deque_memory_usage reserved = container.memory_usage();
+	EXPECT_EQ(reserved.elements, 0);
+	EXPECT_GT(reserved.idle_nodes, 0);
+
+	std::vector<const int *> addresses;
+	for (int i = 0; i < 1000; i++)
+		addresses.push_back(&container.emplace_back(i));
+	stable_deque_memory_usage filled = container.memory_usage();
+	EXPECT_EQ(pool_bytes(filled), pool_bytes(reserved));
+	EXPECT_EQ(filled.elements, 1000 * sizeof(int));
+	EXPECT_EQ(filled.idle_nodes, 0);
+	EXPECT_GT(filled.node_table, 1000 * sizeof(void *));
+
+	// The burst past the reservation lands in new chunks, which are idle again once it is erased
+	for (int i = 1000; i < 5000; i++)
+		container.push_back(i);
+	EXPECT_GT(pool_bytes(container.memory_usage()), pool_bytes(reserved));
+	container.erase(container.begin() + 1000, container.end());
+	container.shrink_to_fit();
+	EXPECT_EQ(pool_bytes(container.memory_usage()), pool_bytes(reserved));
+	for (int i = 0; i < 1000; i++)
 	{
-		title_and_val.push_back({ title, timepoint });
-		return *this;
+		EXPECT_EQ(*addresses[i], i);
+		EXPECT_EQ(container[i], i);
 	}
-	void emitChart(std::string title)
+
+	// Nodes freed by the shrink must not be handed out again
+	for (int i = 1000; i < 1100; i++)
+		container.push_front(i);
+	EXPECT_EQ(container.size(), 1100);
+	EXPECT_EQ(container[0], 1099);
+	EXPECT_EQ(container[100], 0);
+
+	container.clear();
+	container.shrink_to_fit();
+	stable_deque_memory_usage empty = container.memory_usage();
+	EXPECT_EQ(pool_bytes(empty), 0);
+	EXPECT_EQ(empty.total(), empty.node_table + empty.positions);
+}
+
+TEST(StableDequeTest, MemoryFootprint)
+{
+	check_memory_footprint<stable_deque<int>>();
+	check_memory_footprint<blocked_stable_deque<int>>();
+	check_memory_footprint<ordered_stable_deque<int>>();
+	check_memory_footprint<slot_stable_deque<int>>();
+	check_memory_footprint<vector_stable_deque<int>>();
+
+	// Without the pool every node is its own allocation, nothing is idle or reservable
+	stable_deque<int, std::allocator<int>, unpooled_options> unpooled;
+	unpooled.reserve(100);
+	unpooled.push_back(1);
+	EXPECT_EQ(unpooled.memory_usage().idle_nodes, 0);
+	EXPECT_EQ(unpooled.memory_usage().elements, sizeof(int));
+}
+
+// Middle erases leave tombstones behind: everything that walks or indexes the container has to
+// step over them, and they must never end up at either end
+template<typename Container>
+void check_tombstones()
+{
+	Container container;
+	std::vector<const int *> addresses;
+	for (int i = 0; i < 1000; i++)
+		addresses.push_back(&container.emplace_back(i));
+
+	// One sweep over the whole container, compacting along the way
+	for (auto iter = container.begin(); iter != container.end();)
+		iter = *iter % 2 == 1 ? container.erase(iter) : std::next(iter);
+	ASSERT_EQ(container.size(), 500);
+	for (int i = 0; i < 1000; i += 2)
+		EXPECT_EQ(*addresses[i], i);
+
+	container.compact();
+	EXPECT_EQ(container.memory_usage().tombstones, 0);
+
+	// Below the threshold nothing is compacted, yet every way of looking at the contents agrees
+	std::vector<int> expected;
+	for (int i = 0; i < 1000; i += 2)
+		expected.push_back(i);
+	for (int index : { 10, 100, 101 })
 	{
-		if (title_and_val.size() == 0)
-			return;
+		container.erase(container.begin() + index);
+		expected.erase(expected.begin() + index);
+	}
+	stable_deque_memory_usage usage = container.memory_usage();
+	EXPECT_EQ(usage.tombstones, 3 * (sizeof(int) + usage.node_overhead / container.size()));
+	ASSERT_EQ(container.size(), expected.size());
+	EXPECT_EQ(std::distance(container.begin(), container.end()), (std::ptrdiff_t)expected.size());
+	EXPECT_EQ(container.end() - container.begin(), (std::ptrdiff_t)expected.size());
+	EXPECT_TRUE(std::equal(container.begin(), container.end(), expected.begin(), expected.end()));
+	EXPECT_TRUE(std::equal(container.rbegin(), container.rend(), expected.rbegin(), expected.rend()));
+	for (int64_t i = 0; i < (int64_t)expected.size(); i++)
+		EXPECT_EQ(container[i], expected[i]);
+	std::vector<int> walked;
+	container.for_each([&](int value) { walked.push_back(value); });
+	EXPECT_EQ(walked, expected);
+	walked.clear();
+	container.for_each_segment([&](auto segment) { walked.insert(walked.end(), segment.begin(), segment.end()); });
+	EXPECT_EQ(walked, expected);
+	EXPECT_EQ(*std::lower_bound(container.begin(), container.end(), 201), *std::lower_bound(expected.begin(), expected.end(), 201));
+
+	// Inserting next to a tombstone
+	container.insert(container.begin() + 10, -1);
+	expected.insert(expected.begin() + 10, -1);
+	EXPECT_TRUE(std::equal(container.begin(), container.end(), expected.begin(), expected.end()));
 
-		int64_t longest_name = -1;
-		int64_t max_val = -1;
-		for (auto i : title_and_val)
+	container.compact();
+	EXPECT_EQ(container.memory_usage().tombstones, 0);
+	EXPECT_TRUE(std::equal(container.begin(), container.end(), expected.begin(), expected.end()));
+
+	// A tombstone that becomes the first or last node is dropped right away
+	container.erase(container.begin() + 1);
+	container.erase(container.end() - 2);
+	container.erase(container.begin());
+	container.erase(container.end() - 1);
+	expected = std::vector<int>(expected.begin() + 2, expected.end() - 2);
+	EXPECT_EQ(*container.begin(), expected.front());
+	EXPECT_EQ(*(container.end() - 1), expected.back());
+	EXPECT_EQ(container.memory_usage().tombstones, 0);
+	EXPECT_TRUE(std::equal(container.begin(), container.end(), expected.begin(), expected.end()));
+
+	EXPECT_EQ(container.erase_if([](int value) { return value % 4 == 0; }), std::ranges::count_if(expected, [](int value) { return value % 4 == 0; }));
+	container.erase(container.begin() + 3);
+	container.clear();
+	EXPECT_TRUE(container.empty());
+	EXPECT_EQ(container.begin(), container.end());
+
+	// Queue traffic with middle edits, checking indexing and iterator arithmetic all along, which
+	// go through the rank index while tombstones exist
+	std::deque<int> reference;
+	for (int i = 0; i < 2000; i++)
+	{
+		container.push_back(i);
+		reference.push_back(i);
+	}
+	std::mt19937 rng(3);
+	for (int step = 0; step < 20000; step++)
+	{
+		int value = (int)rng();
+		unsigned roll = rng() % 100;
+		if (roll < 35 || reference.size() < 3)
 		{
-			if (max_val < i.second)
-				max_val = i.second;
-			if (longest_name < (int64_t)i.first.size())
-				longest_name = (int64_t)i.first.size();
+			container.push_back(value);
+			reference.push_back(value);
 		}
-		
-		std::cout << "----[" << title << "]----\n";
-		
-		auto dstep_count = (double)step_count;
-		// Logic to draw the chart
-		for (const auto& item : title_and_val)
+		else if (roll < 45)
+		{
+			container.push_front(value);
+			reference.push_front(value);
+		}
+		else if (roll < 65)
+		{
+			container.erase(container.begin());
+			reference.pop_front();
+		}
+		else if (roll < 70)
+		{
+			container.erase(container.end() - 1);
+			reference.pop_back();
+		}
+		else if (roll < 95)
+		{
+			// A quarter next to either end, so pops keep uncovering tombstones
+			std::size_t index = rng() % reference.size();
+			if (roll % 4 == 0)
+				index = rng() % 2 ? std::min<std::size_t>(rng() % 3, reference.size() - 1) : reference.size() - 1 - rng() % 3;
+			auto next = container.erase(container.begin() + index);
+			reference.erase(reference.begin() + index);
+			ASSERT_EQ(next - container.begin(), (std::ptrdiff_t)index);
+		}
+		else
+		{
+			std::size_t index = rng() % (reference.size() + 1);
+			container.insert(container.begin() + index, value);
+			reference.insert(reference.begin() + index, value);
+		}
+
+		ASSERT_EQ(container.size(), reference.size());
+		for (int check = 0; check < 4 && !reference.empty(); check++)
+		{
+			int64_t index = rng() % reference.size();
+			ASSERT_EQ(container[index], reference[index]);
+			auto iter = container.begin() + index;
+			ASSERT_EQ(*iter, reference[index]);
+			ASSERT_EQ(iter - container.begin(), index);
+			ASSERT_EQ(container.end() - iter, (int64_t)reference.size() - index);
+			ASSERT_EQ(*(container.end() - ((int64_t)reference.size() - index)), reference[index]);
+		}
+	}
+	EXPECT_TRUE(std::equal(container.begin(), container.end(), reference.begin(), reference.end()));
+}
+
+TEST(StableDequeTest, Tombstones)
+{
+	check_tombstones<tombstone_stable_deque<int>>();
+	check_tombstones<stable_deque<int, std::allocator<int>, blocked_tombstone_options>>();
+	check_tombstones<stable_deque<int, std::allocator<int>, slot_tombstone_options>>();
+	check_tombstones<tombstone_vector_stable_deque<int>>();
+
+	// Erasing destroys the element right away, compaction only frees the node
+	auto token = std::make_shared<int>(0);
+	{
+		tombstone_stable_deque<std::shared_ptr<int>> container;
+		for (int i = 0; i < 10; i++)
+			container.push_back(token);
+		container.erase(container.begin() + 5);
+		EXPECT_EQ(token.use_count(), 10);
+		container.compact();
+		EXPECT_EQ(token.use_count(), 10);
+	}
+	EXPECT_EQ(token.use_count(), 1);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// Round trip through both loaders, which must rebuild the same elements and the same split
+template<typename Container>
+void check_snapshot_round_trip(const char *path)
+{
+	Container saved;
+	for (int i = 0; i < 50000; i++)
+		saved.push_back(i);
+	for (int i = 1; i <= 30000; i++)
+		saved.push_front(-i);
+	saved.erase(saved.begin() + 20000, saved.begin() + 20100);
+	saved.erase(saved.begin() + 40000);
+
+	int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	ASSERT_GE(fd, 0);
+	save_snapshot(saved, fd);
+
+	Container loaded;
+	loaded.push_back(12345);
+	ASSERT_EQ(::lseek(fd, 0, SEEK_SET), 0);
+	load_snapshot(loaded, fd);
+	::close(fd);
+	EXPECT_EQ(loaded.left_size(), saved.left_size());
+	EXPECT_TRUE(std::ranges::equal(loaded, saved));
+
+	Container mapped;
+	map_snapshot(mapped, path);
+	EXPECT_EQ(mapped.left_size(), saved.left_size());
+	EXPECT_TRUE(std::ranges::equal(mapped, saved));
+
+	// Both sides keep working like on any other deque
+	mapped.push_front(-100000);
+	mapped.insert(mapped.begin() + 1000, 7);
+	mapped.erase(mapped.end() - 10);
+	saved.push_front(-100000);
+	saved.insert(saved.begin() + 1000, 7);
+	saved.erase(saved.end() - 10);
+	EXPECT_TRUE(std::ranges::equal(mapped, saved));
+}
+
+TEST(StableDequeTest, Snapshot)
+{
+	char path[] = "/tmp/stable_deque_snapshot_XXXXXX";
+	int fd = ::mkstemp(path);
+	ASSERT_GE(fd, 0);
+	::close(fd);
+
+	check_snapshot_round_trip<stable_deque<int>>(path);
+	check_snapshot_round_trip<blocked_stable_deque<int>>(path);
+	check_snapshot_round_trip<ordered_stable_deque<int>>(path);
+	check_snapshot_round_trip<slot_stable_deque<int>>(path);
+	check_snapshot_round_trip<tombstone_stable_deque<int>>(path);
+
+	// Empty deque
+	stable_deque<int> empty;
+	fd = ::open(path, O_RDWR | O_TRUNC);
+	save_snapshot(empty, fd);
+	::close(fd);
+	stable_deque<int> loaded{};
+	loaded.push_back(1);
+	map_snapshot(loaded, path);
+	EXPECT_TRUE(loaded.empty());
+
+	// Wrong element type, a truncated payload, then a header claiming far more elements than the
+	// file holds: all of them throw before the target is touched
+	stable_deque<int> source;
+	for (int i = 0; i < 1000; i++)
+		source.push_back(i);
+	fd = ::open(path, O_RDWR | O_TRUNC);
+	save_snapshot(source, fd);
+	stable_deque<int64_t> wrongType;
+	EXPECT_THROW(map_snapshot(wrongType, path), std::runtime_error);
+	for (int i = 0; i < 3; i++)
+		loaded.push_back(i);
+	ASSERT_EQ(::ftruncate(fd, sizeof(stable_deque_snapshot_header) + 500 * sizeof(int) + 2), 0);
+	ASSERT_EQ(::lseek(fd, 0, SEEK_SET), 0);
+	EXPECT_THROW(load_snapshot(loaded, fd), std::runtime_error);
+	EXPECT_THROW(map_snapshot(loaded, path), std::runtime_error);
+	stable_deque_snapshot_header header;
+	ASSERT_EQ(::pread(fd, &header, sizeof(header), 0), (ssize_t)sizeof(header));
+	header.size = header.left_size = uint64_t(1) << 60;
+	ASSERT_EQ(::pwrite(fd, &header, sizeof(header), 0), (ssize_t)sizeof(header));
+	ASSERT_EQ(::lseek(fd, 0, SEEK_SET), 0);
+	EXPECT_THROW(load_snapshot(loaded, fd), std::runtime_error);
+	::close(fd);
+	EXPECT_THROW(map_snapshot(loaded, path), std::runtime_error);
+	ASSERT_EQ(loaded.size(), 3);
+	for (int64_t i = 0; i < 3; i++)
+		EXPECT_EQ(loaded[i], i);
+	loaded.push_back(-1);
+	EXPECT_EQ(loaded[loaded.size() - 1], -1);
+
+	EXPECT_THROW(map_snapshot(loaded, "/nonexistent/snapshot"), std::system_error);
+	::unlink(path);
+}
+#endif
+
+template<typename Container>
+void check_copy_move_swap()
+{
+	Container sd;
+	std::deque<int> reference;
+	for (int i = 0; i < 300; i++)
+	{
+		sd.push_back(i);
+		sd.push_front(-i - 1);
+	}
+	reference.assign(sd.begin(), sd.end());
+	// Leaves tombstones behind with `tombstone_erase`
+	for (int i = 0; i < 50; i++)
+	{
+		sd.erase(sd.begin() + 100 + i);
+		reference.erase(reference.begin() + 100 + i);
+	}
+	ASSERT_TRUE(std::ranges::equal(sd, reference));
+
+	// A copy is independent and fully usable
+	Container copy(sd);
+	ASSERT_TRUE(std::ranges::equal(copy, reference));
+	EXPECT_NE(&copy[0], &sd[0]);
+	copy.push_front(1000);
+	copy.push_back(1001);
+	copy.insert(copy.begin() + 200, 1002);
+	copy.erase(copy.begin() + 10);
+	EXPECT_TRUE(std::ranges::equal(sd, reference));
+	std::deque<int> copyReference = reference;
+	copyReference.push_front(1000);
+	copyReference.push_back(1001);
+	copyReference.insert(copyReference.begin() + 200, 1002);
+	copyReference.erase(copyReference.begin() + 10);
+	EXPECT_TRUE(std::ranges::equal(copy, copyReference));
+
+	// Moving hands the nodes over, the elements keep their address
+	const int *first = &sd[0];
+	const int *last = &sd[sd.size() - 1];
+	Container moved(std::move(sd));
+	EXPECT_TRUE(sd.empty());
+	EXPECT_EQ(sd.begin(), sd.end());
+	ASSERT_TRUE(std::ranges::equal(moved, reference));
+	EXPECT_EQ(&moved[0], first);
+	EXPECT_EQ(&moved[moved.size() - 1], last);
+	EXPECT_EQ(moved.end() - moved.begin(), (int64_t)reference.size());
+	sd.push_back(7);
+	sd.push_front(6);
+	EXPECT_EQ(sd.size(), 2);
+	EXPECT_EQ(sd[0], 6);
+
+	// Swapping exchanges the contents, addresses included
+	swap(moved, copy);
+	EXPECT_TRUE(std::ranges::equal(copy, reference));
+	EXPECT_TRUE(std::ranges::equal(moved, copyReference));
+	EXPECT_EQ(&copy[0], first);
+	copy.push_back(2000);
+	moved.erase(moved.begin());
+	reference.push_back(2000);
+	copyReference.pop_front();
+	EXPECT_TRUE(std::ranges::equal(copy, reference));
+	EXPECT_TRUE(std::ranges::equal(moved, copyReference));
+
+	// Assignments, self-assignment included
+	sd = copy;
+	EXPECT_TRUE(std::ranges::equal(sd, reference));
+	sd = sd;
+	EXPECT_TRUE(std::ranges::equal(sd, reference));
+	sd = std::move(moved);
+	EXPECT_TRUE(std::ranges::equal(sd, copyReference));
+	EXPECT_TRUE(moved.empty());
+	sd = std::move(sd);
+	EXPECT_TRUE(std::ranges::equal(sd, copyReference));
+	sd = Container();
+	EXPECT_TRUE(sd.empty());
+
+	// Containers of containers can grow
+	std::vector<Container> outer;
+	for (int i = 0; i < 20; i++)
+	{
+		outer.emplace_back();
+		for (int j = 0; j <= i; j++)
+			outer.back().push_back(j);
+	}
+	for (int i = 0; i < 20; i++)
+	{
+		ASSERT_EQ(outer[i].size(), i + 1);
+		EXPECT_EQ(outer[i][i], i);
+	}
+}
+
+// Throws from the copy constructor once `copiesLeft` runs out
+struct ThrowingCopy
+{
+	static inline int copiesLeft = 0;
+
+	int value;
+	ThrowingCopy(int value) : value(value)
+	{
+	}
+	ThrowingCopy(const ThrowingCopy &other) : value(other.value)
+	{
+		if (copiesLeft-- == 0)
+			throw std::runtime_error("copy");
+	}
+};
+
+TEST(StableDequeTest, CopyMoveSwap)
+{
+	check_copy_move_swap<stable_deque<int>>();
+	check_copy_move_swap<stable_deque<int, std::allocator<int>, unpooled_options>>();
+	check_copy_move_swap<blocked_stable_deque<int>>();
+	check_copy_move_swap<ordered_stable_deque<int>>();
+	check_copy_move_swap<slot_stable_deque<int>>();
+	check_copy_move_swap<tombstone_stable_deque<int>>();
+	check_copy_move_swap<stable_deque<int, std::allocator<int>, blocked_tombstone_options>>();
+	check_copy_move_swap<stable_deque<int, std::allocator<int>, stats_options>>();
+	check_copy_move_swap<vector_stable_deque<int>>();
+	check_copy_move_swap<tombstone_vector_stable_deque<int>>();
+
+	// The stats stay with their container
+	stable_deque<int, std::allocator<int>, stats_options> counted;
+	counted.push_back(1);
+	stable_deque<int, std::allocator<int>, stats_options> other(counted);
+	EXPECT_EQ(counted.stats().node_allocations, 1);
+	EXPECT_EQ(other.stats().node_allocations, 1);
+	swap(counted, other);
+	other.push_back(2);
+	EXPECT_EQ(counted.stats().node_allocations, 1);
+	EXPECT_EQ(other.stats().node_allocations, 2);
+
+	// A copy that throws halfway frees what it made
+	stable_deque<ThrowingCopy> throwing;
+	vector_stable_deque<ThrowingCopy> vectorThrowing;
+	ThrowingCopy::copiesLeft = 1000;
+	for (int i = 0; i < 100; i++)
+	{
+		throwing.push_back(i);
+		vectorThrowing.push_back(i);
+	}
+	ThrowingCopy::copiesLeft = 40;
+	EXPECT_THROW(stable_deque<ThrowingCopy>{throwing}, std::runtime_error);
+	ThrowingCopy::copiesLeft = 40;
+	EXPECT_THROW(vector_stable_deque<ThrowingCopy>{vectorThrowing}, std::runtime_error);
+	ThrowingCopy::copiesLeft = 1000;
+	stable_deque<ThrowingCopy> copied(throwing);
+	EXPECT_EQ(copied[99].value, 99);
+}
+
+// Forwards to the global heap and keeps track of what is still allocated
+struct counting_resource : std::pmr::memory_resource
+{
+	int64_t outstanding = 0;
+	int64_t allocations = 0;
+
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		outstanding += bytes;
+		allocations++;
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void *pointer, std::size_t bytes, std::size_t alignment) override
+	{
+		outstanding -= bytes;
+		std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+template<typename Container>
+void check_memory_resources()
+{
+	counting_resource resourceA;
+	counting_resource resourceB;
+	// Anything that skips the container's allocator throws
+	std::pmr::memory_resource *previous = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+	{
+		Container a(&resourceA);
+		std::deque<int> reference;
+		for (int i = 0; i < 500; i++)
 		{
-			// 1. Print the label, padded to the longest name
-			std::cout << std::setw(longest_name) << std::right << item.first << " | ";
+			a.push_back(i);
+			a.push_front(-i);
+			reference.push_back(i);
+			reference.push_front(-i);
+		}
+		a.erase(a.begin() + 300);
+		reference.erase(reference.begin() + 300);
+		EXPECT_EQ(a.get_allocator().resource(), &resourceA);
+		EXPECT_GT(resourceA.outstanding, 1000 * sizeof(int));
+		EXPECT_EQ(resourceB.allocations, 0);
+
+		// Copies default to the default resource, like the standard containers
+		EXPECT_THROW(Container{a}, std::bad_alloc);
+		Container b(a, &resourceB);
+		EXPECT_TRUE(std::ranges::equal(b, reference));
+		EXPECT_GT(resourceB.outstanding, 1000 * sizeof(int));
+
+		// Moving within one resource hands the nodes over, across resources moves the elements
+		const int *first = &a[0];
+		Container c(std::move(a));
+		EXPECT_EQ(c.get_allocator().resource(), &resourceA);
+		EXPECT_EQ(&c[0], first);
+		Container d(std::move(c), &resourceB);
+		EXPECT_EQ(d.get_allocator().resource(), &resourceB);
+		EXPECT_NE(&d[0], first);
+		EXPECT_TRUE(std::ranges::equal(d, reference));
+
+		// Polymorphic allocators don't propagate on assignment
+		Container e(&resourceA);
+		e.push_back(1);
+		e = std::move(d);
+		EXPECT_EQ(e.get_allocator().resource(), &resourceA);
+		EXPECT_TRUE(std::ranges::equal(e, reference));
+		e = b;
+		EXPECT_EQ(e.get_allocator().resource(), &resourceA);
+		EXPECT_TRUE(std::ranges::equal(e, reference));
+
+		Container f(&resourceA);
+		f.push_back(1);
+		swap(e, f);
+		EXPECT_EQ(e.size(), 1);
+		EXPECT_TRUE(std::ranges::equal(f, reference));
+	}
+	EXPECT_EQ(resourceA.outstanding, 0);
+	EXPECT_EQ(resourceB.outstanding, 0);
+
+	// A per-request arena with nothing behind it
+	{
+		std::vector<std::byte> buffer(1 << 20);
+		std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+		Container g(&arena);
+		for (int i = 0; i < 1000; i++)
+			g.push_back(i);
+		g.erase(g.begin() + 10, g.begin() + 20);
+		g.shrink_to_fit();
+		EXPECT_EQ(g[10], 20);
+	}
+	std::pmr::set_default_resource(previous);
+}
+
+// Stateful allocator that follows the memory on every assignment and swap
+template<typename T>
+struct propagating_allocator
+{
+	using value_type = T;
+	using propagate_on_container_copy_assignment = std::true_type;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	// Bytes allocated through the allocators of each id
+	static inline std::array<int64_t, 4> outstanding{};
 
-			// 2. Calculate bar length relative to max_val and step_count
-			int64_t bar_length = 0;
-			if (max_val > 0) {
-				bar_length = (int64_t)(((double)item.second / (double)max_val) * dstep_count);
+	int id;
+
+	propagating_allocator(int id) : id(id)
+	{
+	}
+
+	template<typename U>
+	propagating_allocator(const propagating_allocator<U> &other) : id(other.id)
+	{
+	}
+
+	T *allocate(std::size_t count)
+	{
+		propagating_allocator<char>::outstanding[id] += count * sizeof(T);
+		return std::allocator<T>().allocate(count);
+	}
+
+	void deallocate(T *pointer, std::size_t count)
+	{
+		propagating_allocator<char>::outstanding[id] -= count * sizeof(T);
+		std::allocator<T>().deallocate(pointer, count);
+	}
+
+	friend bool operator==(const propagating_allocator &left, const propagating_allocator &right)
+	{
+		return left.id == right.id;
+	}
+};
+
+template<typename Container>
+void check_propagating_allocator()
+{
+	auto &outstanding = propagating_allocator<char>::outstanding;
+	{
+		Container a(propagating_allocator<int>(1));
+		Container b(propagating_allocator<int>(2));
+		for (int i = 0; i < 100; i++)
+			a.push_back(i);
+		for (int i = 0; i < 50; i++)
+			b.push_front(i);
+		std::vector<int> bValues(b.begin(), b.end());
+
+		// `a` gives its memory back to allocator 1 and takes allocator 2 over
+		a = b;
+		EXPECT_EQ(a.get_allocator().id, 2);
+		EXPECT_EQ(outstanding[1], 0);
+		EXPECT_TRUE(std::ranges::equal(a, bValues));
+
+		Container c(propagating_allocator<int>(3));
+		for (int i = 0; i < 10; i++)
+			c.push_back(i);
+		const int *first = &a[0];
+		c = std::move(a);
+		EXPECT_EQ(c.get_allocator().id, 2);
+		EXPECT_EQ(&c[0], first);
+		EXPECT_EQ(outstanding[3], 0);
+		c.push_back(-1);
+
+		Container d(propagating_allocator<int>(3));
+		d.push_back(7);
+		swap(c, d);
+		EXPECT_EQ(c.get_allocator().id, 3);
+		EXPECT_EQ(d.get_allocator().id, 2);
+		EXPECT_EQ(c.size(), 1);
+		EXPECT_EQ(d[0], first[0]);
+		EXPECT_EQ(d[d.size() - 1], -1);
+	}
+	for (int64_t bytes : outstanding)
+		EXPECT_EQ(bytes, 0);
+}
+
+TEST(StableDequeTest, AllocatorAware)
+{
+	check_memory_resources<::pmr::stable_deque<int>>();
+	check_memory_resources<::pmr::stable_deque<int, blocked_options>>();
+	check_memory_resources<::pmr::stable_deque<int, slot_options>>();
+	check_memory_resources<::pmr::stable_deque<int, tombstone_options>>();
+	check_memory_resources<::pmr::stable_deque<int, stats_options>>();
+	check_memory_resources<::pmr::stable_deque<int, unpooled_options>>();
+	check_memory_resources<::pmr::vector_stable_deque<int>>();
+	check_memory_resources<::pmr::vector_stable_deque<int, tombstone_options>>();
+
+	check_propagating_allocator<stable_deque<int, propagating_allocator<int>>>();
+	check_propagating_allocator<stable_deque<int, propagating_allocator<int>, blocked_options>>();
+	check_propagating_allocator<stable_deque<int, propagating_allocator<int>, slot_options>>();
+	check_propagating_allocator<vector_stable_deque<int, propagating_allocator<int>>>();
+}
+
+// Lives in a pool of its own, linked into two intrusive deques at once
+struct Job : stable_deque_hook<>, stable_deque_hook<struct ByPriority>
+{
+	int id;
+	Job(int id) : id(id)
+	{
+	}
+};
+
+static_assert(std::random_access_iterator<intrusive_stable_deque<Job>::iterator>);
+static_assert(std::random_access_iterator<intrusive_stable_deque<Job>::const_iterator>);
+
+TEST(StableDequeTest, Intrusive)
+{
+	std::vector<Job> pool;
+	for (int i = 0; i < 2000; i++)
+		pool.emplace_back(i);
+
+	intrusive_stable_deque<Job> jobs;
+	std::deque<Job *> reference;
+	std::vector<bool> linked(pool.size(), false);
+	std::mt19937 rng(11);
+	auto unlinked_job = [&]() -> Job * {
+		for (int tries = 0; tries < 16; tries++)
+		{
+			int id = rng() % pool.size();
+			if (!linked[id])
+			{
+				linked[id] = true;
+				return &pool[id];
 			}
+		}
+		return nullptr;
+	};
 
-			// 3. Draw the bar
-			for (int k = 0; k < bar_length; ++k) {
-				std::cout << "#";
+	for (int step = 0; step < 6000; step++)
+	{
+		int op = rng() % 9;
+		if (op < 3)
+		{
+			if (Job *job = unlinked_job())
+			{
+				if (op == 0)
+				{
+					jobs.push_back(*job);
+					reference.push_back(job);
+				}
+				else if (op == 1)
+				{
+					jobs.push_front(*job);
+					reference.push_front(job);
+				}
+				else
+				{
+					int64_t index = rng() % (reference.size() + 1);
+					auto iter = jobs.insert(jobs.begin() + index, *job);
+					EXPECT_EQ(&*iter, job);
+					reference.insert(reference.begin() + index, job);
+				}
+			}
+		}
+		else if (!reference.empty())
+		{
+			int64_t index = rng() % reference.size();
+			Job *job = reference[index];
+			if (op == 3)
+			{
+				jobs.pop_front();
+				job = reference.front();
+				reference.pop_front();
 			}
+			else if (op == 4)
+			{
+				jobs.pop_back();
+				job = reference.back();
+				reference.pop_back();
+			}
+			else if (op == 5)
+			{
+				// By reference, found through the hook
+				EXPECT_EQ(jobs.index_of(*job), index);
+				jobs.erase(*job);
+				reference.erase(reference.begin() + index);
+			}
+			else if (op == 6)
+			{
+				auto next = jobs.erase(jobs.begin() + index);
+				reference.erase(reference.begin() + index);
+				EXPECT_EQ(next - jobs.begin(), index);
+			}
+			else
+			{
+				int64_t last = std::min<int64_t>(index + rng() % 20, reference.size());
+				for (int64_t i = index; i < last; i++)
+					linked[reference[i]->id] = false;
+				jobs.erase(jobs.begin() + index, jobs.begin() + last);
+				reference.erase(reference.begin() + index, reference.begin() + last);
+				continue;
+			}
+			linked[job->id] = false;
+		}
 
-			// 4. Print the val
-			std::cout << " (" << item.second << ")\n";
+		ASSERT_EQ(jobs.size(), reference.size());
+		if (step % 100 == 0)
+		{
+			for (int64_t i = 0; i < (int64_t)reference.size(); i++)
+			{
+				ASSERT_EQ(&jobs[i], reference[i]);
+				ASSERT_EQ(jobs.index_of(*reference[i]), i);
+				ASSERT_EQ(jobs.iterator_to(*reference[i]) - jobs.begin(), i);
+			}
+			ASSERT_TRUE(std::ranges::equal(jobs, reference, [](const Job &job, const Job *expected) { return &job == expected; }));
 		}
+	}
 
-		std::cout << "-----" << title << "-----\n\n\n";
+	// The objects are never copied, a second hook links them into another deque at the same time
+	intrusive_stable_deque<Job, stable_deque_hook<ByPriority>> byPriority;
+	for (Job *job : reference)
+		byPriority.push_front(*job);
+	ASSERT_EQ(byPriority.size(), reference.size());
+	if (!reference.empty())
+	{
+		EXPECT_EQ(&byPriority.back(), reference.front());
+		EXPECT_EQ(&jobs.front(), reference.front());
 	}
-};
 
-#define str(chars) std::string(chars)
-TEST(StableDequeTest, Perf)
-{
-	// Note: removed `vector_stable_deque` because it is such a large (negative) diff. in performance that it wreaks the graphs scaling
-#define PROFILE_FUNC(func_name, T) \
-	{ \
-		std::cout << "\n" << #func_name << "<" << typeid(T).name() << ">:\n"; \
-		std::string TName = str(typeid(T).name()); \
-		std::string deque_name = str("deque<") + TName + ">"; \
-		std::string stable_deque_name = str("stable_deque<") + TName + ">"; \
-		std::string stable_vector_name = str("stable_vector<") + TName + ">"; \
-		std::string vector_name = str("vector<") + TName + ">"; \
-		ASCIIBarChartGenerator() \
-		(deque_name, func_name<T, std::deque<T>>(deque_name)) \
-		(stable_deque_name, func_name<T, stable_deque<T>>(stable_deque_name)) \
-		(stable_vector_name, func_name<T, stable_vector<T>>(stable_vector_name)) \
-		(vector_name, func_name<T, std::vector<T>>(vector_name)) \
-		.emitChart(#func_name); \
-	}
-
-	PROFILE_FUNC(push_front_profile, int);
-	PROFILE_FUNC(push_front_profile, BigData);
-
-	PROFILE_FUNC(push_back_profile, int);
-	PROFILE_FUNC(push_back_profile, BigData);
-
-	PROFILE_FUNC(erase_front_profile, int);
-	PROFILE_FUNC(erase_front_profile, BigData);
-
-	PROFILE_FUNC(erase_back_profile, int);
-	PROFILE_FUNC(erase_back_profile, BigData);
-}
\ No newline at end of file
+	// Moving hands the links over
+	intrusive_stable_deque<Job> moved(std::move(jobs));
+	EXPECT_TRUE(jobs.empty());
+	EXPECT_EQ(moved.size(), reference.size());
+	int64_t index = 0;
+	moved.for_each([&](Job &job) { EXPECT_EQ(&job, reference[index++]); });
+	Job extra(-1);
+	jobs.push_back(extra);
+	swap(jobs, moved);
+	EXPECT_EQ(&moved.front(), &extra);
+	EXPECT_EQ(jobs.size(), reference.size());
+	EXPECT_EQ(jobs.end() - jobs.begin(), (int64_t)reference.size());
+	moved.pop_back();
+
+	// Copies of an object aren't linked anywhere
+	Job copy = pool[0];
+	copy = pool[1];
+	EXPECT_EQ(copy.id, 1);
+
+	jobs.clear();
+	EXPECT_TRUE(jobs.empty());
+	jobs.push_front(pool[5]);
+	EXPECT_EQ(jobs.index_of(pool[5]), 0);
+
+	// Moving across resources copies the pointers into the target's resource
+	counting_resource resourceA;
+	counting_resource resourceB;
+	{
+		using pmr_jobs = intrusive_stable_deque<Job, stable_deque_hook<ByPriority>, std::pmr::polymorphic_allocator<Job *>>;
+		pmr_jobs a(&resourceA);
+		pmr_jobs b(&resourceB);
+		for (int i = 10; i < 110; i++)
+			a.push_back(pool[i]);
+		a.push_front(pool[9]);
+		b.push_back(pool[200]);
+		b.pop_back();
+		b = std::move(a);
+		EXPECT_EQ(b.get_allocator().resource(), &resourceB);
+		EXPECT_TRUE(a.empty());
+		ASSERT_EQ(b.size(), 101);
+		for (int i = 0; i < 101; i++)
+		{
+			EXPECT_EQ(&b[i], &pool[9 + i]);
+			EXPECT_EQ(b.index_of(pool[9 + i]), i);
+		}
+		EXPECT_EQ(b.end() - b.begin(), 101);
+		b.erase(b.begin() + 50);
+		EXPECT_EQ(b.index_of(pool[60]), 50);
+		b.clear();
+	}
+	EXPECT_EQ(resourceA.outstanding, 0);
+	EXPECT_EQ(resourceB.outstanding, 0);
+}
+
+TEST(StableDequeTest, Concurrent)
+{
+	// Single threaded, it has to behave like any deque, including popping across `middle`
+	{
+		concurrent_stable_deque<int> container;
+		std::deque<int> reference;
+		std::mt19937 rng(7);
+		for (int i = 0; i < 20000; i++)
+		{
+			switch (rng() % 4)
+			{
+			case 0: container.push_front(i); reference.push_front(i); break;
+			case 1: container.push_back(i); reference.push_back(i); break;
+			case 2:
+			{
+				std::optional<int> value = container.try_pop_front();
+				ASSERT_EQ(value.has_value(), !reference.empty());
+				if (value)
+				{
+					EXPECT_EQ(*value, reference.front());
+					reference.pop_front();
+				}
+				break;
+			}
+			case 3:
+			{
+				std::optional<int> value = container.try_pop_back();
+				ASSERT_EQ(value.has_value(), !reference.empty());
+				if (value)
+				{
+					EXPECT_EQ(*value, reference.back());
+					reference.pop_back();
+				}
+				break;
+			}
+			}
+		}
+		ASSERT_EQ(container.size(), reference.size());
+		std::vector<int> contents;
+		container.for_each([&](int value) { contents.push_back(value); });
+		EXPECT_TRUE(std::ranges::equal(contents, reference));
+	}
+
+	// Producers on both ends, consumers on both ends: every value comes out exactly once,
+	// and values from a producer come out of the opposite end in the order they went in
+	{
+		concurrent_stable_deque<int> container;
+		constexpr int perProducer = 20000;
+		std::vector<std::atomic<int>> seen(2 * perProducer);
+		std::atomic<int> consumed = 0;
+		std::atomic<bool> inOrder = true;
+
+		std::thread backProducer([&] {
+			for (int i = 0; i < perProducer; i++)
+				container.push_back(i);
+		});
+		std::thread frontProducer([&] {
+			for (int i = 0; i < perProducer; i++)
+				container.push_front(perProducer + i);
+		});
+		auto consumer = [&](bool fromFront) {
+			int lastBack = -1;
+			int lastFront = -1;
+			while (consumed < 2 * perProducer)
+			{
+				std::optional<int> value = fromFront ? container.try_pop_front() : container.try_pop_back();
+				if (!value)
+					continue;
+				seen[*value]++;
+				consumed++;
+				int &last = *value < perProducer ? lastBack : lastFront;
+				bool opposite = (*value < perProducer) == fromFront;
+				if (opposite && *value < last)
+					inOrder = false;
+				last = *value;
+			}
+		};
+		std::thread frontConsumer(consumer, true);
+		std::thread backConsumer(consumer, false);
+		backProducer.join();
+		frontProducer.join();
+		frontConsumer.join();
+		backConsumer.join();
+
+		EXPECT_TRUE(container.empty());
+		EXPECT_TRUE(inOrder);
+		EXPECT_TRUE(std::ranges::all_of(seen, [](const std::atomic<int> &count) { return count == 1; }));
+	}
+}
+
+TEST(StableDequeTest, WorkStealing)
+{
+	// Single threaded: `pop()` is LIFO, `steal()` FIFO, and elements survive the ring growing
+	{
+		work_stealing_deque<int> container;
+		std::deque<int> reference;
+		std::map<int, const int *> addresses;
+		std::mt19937 rng(11);
+		for (int i = 0; i < 20000; i++)
+		{
+			switch (rng() % 5)
+			{
+			case 0:
+			case 1:
+				addresses[i] = &container.emplace(i);
+				reference.push_back(i);
+				break;
+			case 2:
+			case 3:
+			{
+				std::optional<int> value = container.pop();
+				ASSERT_EQ(value.has_value(), !reference.empty());
+				if (value)
+				{
+					EXPECT_EQ(*value, reference.back());
+					reference.pop_back();
+				}
+				break;
+			}
+			case 4:
+			{
+				std::optional<int> value = container.steal();
+				ASSERT_EQ(value.has_value(), !reference.empty());
+				if (value)
+				{
+					EXPECT_EQ(*value, reference.front());
+					reference.pop_front();
+				}
+				break;
+			}
+			}
+		}
+		ASSERT_EQ(container.size(), reference.size());
+
+		for (int i = 1; i <= 1000; i++)
+		{
+			addresses[-i] = &container.emplace(-i);
+			reference.push_back(-i);
+		}
+		// Whatever is still queued was never moved by the ring growing
+		for (int value : reference)
+			EXPECT_EQ(*addresses[value], value);
+	}
+
+	// The owner pushes and pops, two thieves steal: every value comes out exactly once
+	{
+		work_stealing_deque<int> container;
+		constexpr int total = 100000;
+		std::vector<std::atomic<int>> seen(total);
+		std::atomic<int> taken = 0;
+
+		auto thief = [&] {
+			while (taken < total)
+				if (std::optional<int> value = container.steal())
+				{
+					seen[*value]++;
+					taken++;
+				}
+		};
+		std::thread thief0(thief);
+		std::thread thief1(thief);
+		for (int i = 0; i < total; i++)
+		{
+			container.push(i);
+			if (i % 3 == 0)
+				if (std::optional<int> value = container.pop())
+				{
+					seen[*value]++;
+					taken++;
+				}
+		}
+		while (taken < total)
+			if (std::optional<int> value = container.pop())
+			{
+				seen[*value]++;
+				taken++;
+			}
+		thief0.join();
+		thief1.join();
+
+		EXPECT_TRUE(container.empty());
+		EXPECT_TRUE(std::ranges::all_of(seen, [](const std::atomic<int> &count) { return count == 1; }));
+	}
+}
@@ -0,0 +1,653 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+/// Base class that lets a `T` be linked into an `intrusive_stable_deque`. `Tag` tells several
+/// hooks of one `T` apart, so an object can sit in one container per hook at the same time:
+///
+///     struct Order : stable_deque_hook<struct ByTime>, stable_deque_hook<struct ByPrice> { ... };
+///
+/// The hook holds what a `stable_deque` node holds next to its `T`: the position relative to
+/// `middle`. Copying or assigning an object leaves its hook alone, so a copy is never linked.
+template <typename Tag = void>
+class stable_deque_hook
+{
+	template <typename, typename, typename>
+	friend class intrusive_stable_deque;
+
+	/// Distance from `middle`, without the side bias
+	int64_t pos = 0;
+
+	/// Which side of `middle` the object is on, only changes when it is linked again
+	bool isLeft = false;
+
+public:
+	stable_deque_hook() = default;
+
+	stable_deque_hook(const stable_deque_hook &)
+	{
+	}
+
+	stable_deque_hook &operator=(const stable_deque_hook &)
+	{
+		return *this;
+	}
+};
+
+/// `stable_deque` for objects that live somewhere else (e.g. in the caller's own pools) and derive
+/// from `Hook`. The container only stores `T*` in its `std::deque`, allocates nothing per element
+/// beyond that pointer slot and never constructs, copies or destroys a `T`: `push_back(object)`
+/// links the object itself, `erase()`/`pop_*()`/`clear()` unlink it again.
+///
+/// Positions are kept in the hooks exactly like `stable_deque` keeps them in its nodes (split at
+/// `middle`, one bias per side, the shorter run is renumbered), so random access and iterator
+/// arithmetic are O(1), pushing and popping at either end is O(1), and a middle insert/erase
+/// rewrites the hooks of the shorter run only. `iterator_to()`/`index_of()` find a linked object's
+/// place in O(1) from its hook, so objects can be erased by reference.
+///
+/// An object must be unlinked before it is destroyed and can only be in one container per hook.
+/// Destroying the container leaves the objects alone.
+template <typename T, typename Hook = stable_deque_hook<>, typename Allocator = std::allocator<T *>>
+class intrusive_stable_deque
+{
+	static_assert(std::is_base_of_v<Hook, T>, "T must derive from the hook");
+
+	using HookPAllocator = std::allocator_traits<Allocator>::template rebind_alloc<Hook *>;
+
+	struct intrusive_data
+	{
+		int64_t middle = -1;
+
+		/// Same as in `stable_deque`: offsets added to the `pos` of every hook of a side
+		int64_t leftBias = 0;
+		int64_t rightBias = 0;
+
+		/// [begin(), middle](middle, end()), the end hook last
+		std::deque<Hook *, HookPAllocator> data;
+
+		explicit intrusive_data(const Allocator &allocator) : data(HookPAllocator(allocator))
+		{
+		}
+
+		/// Index of the linked `hook` inside `data`
+		int64_t index_of(const Hook *hook) const
+		{
+			if (hook->isLeft)
+				return middle - (hook->pos + leftBias);
+			else
+				return middle + 1 + hook->pos + rightBias;
+		}
+	} hookData;
+
+	/// Sentinel returned by `end()`, always the last entry of `intrusive_data::data`. Not part of any `T`.
+	Hook endHook;
+
+	template <bool isConst>
+	class basic_iterator
+	{
+		friend class intrusive_stable_deque;
+		template <bool>
+		friend class basic_iterator;
+
+		const intrusive_data *hookDataPtr = nullptr;
+		Hook *hook = nullptr;
+
+		basic_iterator(const intrusive_data *hookDataPtr, Hook *hook) : hookDataPtr(hookDataPtr), hook(hook)
+		{
+		}
+
+		int64_t get_underlying_index() const
+		{
+			return hookDataPtr->index_of(hook);
+		}
+
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using iterator_concept = std::random_access_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = std::conditional_t<isConst, const T *, T *>;
+		using reference = std::conditional_t<isConst, const T &, T &>;
+
+		basic_iterator() = default;
+
+		/// `iterator` converts to `const_iterator`
+		template <bool wasConst>
+			requires(isConst && !wasConst)
+		basic_iterator(const basic_iterator<wasConst> &iter) : hookDataPtr(iter.hookDataPtr), hook(iter.hook)
+		{
+		}
+
+		reference operator*() const
+		{
+			return static_cast<T &>(*hook);
+		}
+
+		pointer operator->() const
+		{
+			return static_cast<T *>(hook);
+		}
+
+		basic_iterator &operator++()
+		{
+			*this += 1;
+			return *this;
+		}
+
+		basic_iterator operator++(int)
+		{
+			basic_iterator tmp(*this);
+			*this += 1;
+			return tmp;
+		}
+
+		basic_iterator &operator--()
+		{
+			*this -= 1;
+			return *this;
+		}
+
+		basic_iterator operator--(int)
+		{
+			basic_iterator tmp(*this);
+			*this -= 1;
+			return tmp;
+		}
+
+		basic_iterator &operator+=(difference_type offset)
+		{
+			hook = hookDataPtr->data[get_underlying_index() + offset];
+			return *this;
+		}
+
+		basic_iterator &operator-=(difference_type offset)
+		{
+			*this += -offset;
+			return *this;
+		}
+
+		friend basic_iterator operator+(const basic_iterator &left, difference_type offset)
+		{
+			basic_iterator tmp(left);
+			tmp += offset;
+			return tmp;
+		}
+
+		friend basic_iterator operator+(difference_type offset, const basic_iterator &right)
+		{
+			basic_iterator tmp(right);
+			tmp += offset;
+			return tmp;
+		}
+
+		friend basic_iterator operator-(const basic_iterator &left, difference_type offset)
+		{
+			basic_iterator tmp(left);
+			tmp -= offset;
+			return tmp;
+		}
+
+		friend difference_type operator-(const basic_iterator &left, const basic_iterator &right)
+		{
+			return left.get_underlying_index() - right.get_underlying_index();
+		}
+
+		friend bool operator==(const basic_iterator &l, const basic_iterator &r)
+		{
+			return l.hook == r.hook;
+		}
+
+		friend bool operator!=(const basic_iterator &l, const basic_iterator &r)
+		{
+			return l.hook != r.hook;
+		}
+
+		friend bool operator<(const basic_iterator &l, const basic_iterator &r)
+		{
+			return l.get_underlying_index() < r.get_underlying_index();
+		}
+
+		friend bool operator<=(const basic_iterator &l, const basic_iterator &r)
+		{
+			return l.get_underlying_index() <= r.get_underlying_index();
+		}
+
+		friend bool operator>(const basic_iterator &l, const basic_iterator &r)
+		{
+			return l.get_underlying_index() > r.get_underlying_index();
+		}
+
+		friend bool operator>=(const basic_iterator &l, const basic_iterator &r)
+		{
+			return l.get_underlying_index() >= r.get_underlying_index();
+		}
+
+		reference operator[](difference_type offset) const
+		{
+			return *(*this + offset);
+		}
+	};
+
+public:
+	using value_type = T;
+	using allocator_type = Allocator;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using reference = T &;
+	using const_reference = const T &;
+	using pointer = T *;
+	using const_pointer = const T *;
+	using iterator = basic_iterator<false>;
+	using const_iterator = basic_iterator<true>;
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+private:
+	/// `stable_deque::fix_up_pointers`, on the hooks stored in [first, last) of `intrusive_data::data`
+	void fix_up_pointers(int64_t first, int64_t last, int64_t amountToShiftEachPointer)
+	{
+		auto end = hookData.data.begin() + last;
+		for (auto iter = hookData.data.begin() + first; iter != end; ++iter)
+			(*iter)->pos += amountToShiftEachPointer;
+	}
+
+	// Same side choice and renumbering as `stable_deque::insert_left`/`insert_right`
+
+	void insert_left(int64_t index, Hook *hook)
+	{
+		// Hooks in [0, index) move further away from `middle`, [index, middle] keep their position
+		if (index <= hookData.middle + 1 - index)
+		{
+			fix_up_pointers(0, index, 1);
+		}
+		else
+		{
+			hookData.leftBias++;
+			fix_up_pointers(index, hookData.middle + 1, -1);
+		}
+		hookData.middle++;
+		hook->isLeft = true;
+		hook->pos = hookData.middle - index - hookData.leftBias;
+		hookData.data.insert(hookData.data.begin() + index, hook);
+	}
+
+	void insert_right(int64_t index, Hook *hook)
+	{
+		int64_t position = index - hookData.middle - 1;
+		// Hooks in [index, end()] move further away from `middle`, (middle, index) keep their position
+		if ((int64_t)hookData.data.size() - index <= position)
+		{
+			fix_up_pointers(index, hookData.data.size(), 1);
+		}
+		else
+		{
+			hookData.rightBias++;
+			fix_up_pointers(hookData.middle + 1, index, -1);
+		}
+		hook->isLeft = false;
+		hook->pos = position - hookData.rightBias;
+		hookData.data.insert(hookData.data.begin() + index, hook);
+	}
+
+	iterator insert_at(int64_t index, T &object)
+	{
+		Hook *hook = &object;
+		// The left side gets the first element, so `push_front()` never has to renumber
+		if (index <= hookData.middle || (index == 0 && hookData.middle == -1))
+			insert_left(index, hook);
+		else
+			insert_right(index, hook);
+		return iterator(&hookData, hook);
+	}
+
+	/// `stable_deque::remove_nodes`: unlinks the objects stored in [first, last) of `intrusive_data::data`
+	void unlink(int64_t first, int64_t last)
+	{
+		int64_t leftLast = std::min(last, hookData.middle + 1);
+		int64_t rightFirst = std::max(first, hookData.middle + 1);
+		int64_t leftCount = std::max<int64_t>(leftLast - first, 0);
+		int64_t rightCount = std::max<int64_t>(last - rightFirst, 0);
+
+		if (leftCount > 0)
+		{
+			// Hooks in [0, first) move closer to `middle`, [leftLast, middle] keep their position
+			if (first <= hookData.middle + 1 - leftLast)
+			{
+				fix_up_pointers(0, first, -leftCount);
+			}
+			else
+			{
+				hookData.leftBias -= leftCount;
+				fix_up_pointers(leftLast, hookData.middle + 1, leftCount);
+			}
+			hookData.middle -= leftCount;
+		}
+		if (rightCount > 0)
+		{
+			// Hooks in [last, end()] move closer to `middle`, (middle, rightFirst) keep their position
+			if ((int64_t)hookData.data.size() - last <= rightFirst - (hookData.middle + leftCount) - 1)
+			{
+				fix_up_pointers(last, hookData.data.size(), -rightCount);
+			}
+			else
+			{
+				hookData.rightBias -= rightCount;
+				fix_up_pointers(hookData.middle + leftCount + 1, rightFirst, rightCount);
+			}
+		}
+
+		if (last - first == 1)
+			hookData.data.erase(hookData.data.begin() + first);
+		else
+			hookData.data.erase(hookData.data.begin() + first, hookData.data.begin() + last);
+	}
+
+	iterator iterator_at(int64_t index)
+	{
+		return iterator(&hookData, hookData.data[index]);
+	}
+
+public:
+	intrusive_stable_deque() : intrusive_stable_deque(Allocator())
+	{
+	}
+
+	/// `allocator` (rebound) only allocates the `std::deque` of pointers
+	explicit intrusive_stable_deque(const Allocator &allocator) : hookData(allocator)
+	{
+		hookData.data.push_back(&endHook);
+	}
+
+	/// An object can't be linked into two containers through the same hook
+	intrusive_stable_deque(const intrusive_stable_deque &) = delete;
+	intrusive_stable_deque &operator=(const intrusive_stable_deque &) = delete;
+
+	/// Takes the linked objects over, `other` ends up empty. Iterators must be obtained again.
+	intrusive_stable_deque(intrusive_stable_deque &&other) : intrusive_stable_deque(other.get_allocator())
+	{
+		swap(other);
+	}
+
+	/// Takes the linked objects over, `other` ends up empty. O(1) if `propagate_on_container_move_assignment`
+	/// is set or the allocators are equal, otherwise the pointers are copied into this container's
+	/// allocator (the objects and their hooks stay as they are).
+	intrusive_stable_deque &operator=(intrusive_stable_deque &&other)
+	{
+		if (this != &other)
+		{
+			// std::deque's move assignment already handles both cases
+			hookData.data = std::move(other.hookData.data);
+			hookData.middle = other.hookData.middle;
+			hookData.leftBias = other.hookData.leftBias;
+			hookData.rightBias = other.hookData.rightBias;
+			endHook.pos = other.endHook.pos;
+			endHook.isLeft = other.endHook.isLeft;
+			hookData.data.back() = &endHook;
+			other.clear();
+		}
+		return *this;
+	}
+
+	/// Exchanges the linked objects in O(1), like `stable_deque::swap()`. The allocators are only
+	/// exchanged if `propagate_on_container_swap` is set, otherwise they must compare equal.
+	void swap(intrusive_stable_deque &other) noexcept
+	{
+		assert(std::allocator_traits<HookPAllocator>::propagate_on_container_swap::value || get_allocator() == other.get_allocator());
+		using std::swap;
+		swap(hookData.middle, other.hookData.middle);
+		swap(hookData.leftBias, other.hookData.leftBias);
+		swap(hookData.rightBias, other.hookData.rightBias);
+		hookData.data.swap(other.hookData.data);
+
+		// The end hooks are part of the containers, so only their state changes hands
+		swap(endHook.pos, other.endHook.pos);
+		swap(endHook.isLeft, other.endHook.isLeft);
+		hookData.data.back() = &endHook;
+		other.hookData.data.back() = &other.endHook;
+	}
+
+	friend void swap(intrusive_stable_deque &left, intrusive_stable_deque &right) noexcept
+	{
+		left.swap(right);
+	}
+
+	allocator_type get_allocator() const
+	{
+		return allocator_type(hookData.data.get_allocator());
+	}
+
+	iterator begin()
+	{
+		return iterator(&hookData, hookData.data.front());
+	}
+
+	iterator end()
+	{
+		return iterator(&hookData, hookData.data.back());
+	}
+
+	const_iterator begin() const
+	{
+		return const_iterator(&hookData, hookData.data.front());
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(&hookData, hookData.data.back());
+	}
+
+	const_iterator cbegin() const
+	{
+		return begin();
+	}
+
+	const_iterator cend() const
+	{
+		return end();
+	}
+
+	reverse_iterator rbegin()
+	{
+		return reverse_iterator(end());
+	}
+
+	reverse_iterator rend()
+	{
+		return reverse_iterator(begin());
+	}
+
+	const_reverse_iterator rbegin() const
+	{
+		return const_reverse_iterator(end());
+	}
+
+	const_reverse_iterator rend() const
+	{
+		return const_reverse_iterator(begin());
+	}
+
+	std::size_t size() const
+	{
+		// -1 for the end hook
+		return hookData.data.size() - 1;
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+	T &operator[](int64_t index)
+	{
+		assert(index >= 0 && index < (int64_t)size());
+		return static_cast<T &>(*hookData.data[index]);
+	}
+
+	const T &operator[](int64_t index) const
+	{
+		assert(index >= 0 && index < (int64_t)size());
+		return static_cast<const T &>(*hookData.data[index]);
+	}
+
+	T &front()
+	{
+		assert(!empty());
+		return static_cast<T &>(*hookData.data.front());
+	}
+
+	const T &front() const
+	{
+		assert(!empty());
+		return static_cast<const T &>(*hookData.data.front());
+	}
+
+	T &back()
+	{
+		assert(!empty());
+		return static_cast<T &>(*hookData.data[hookData.data.size() - 2]);
+	}
+
+	const T &back() const
+	{
+		assert(!empty());
+		return static_cast<const T &>(*hookData.data[hookData.data.size() - 2]);
+	}
+
+	/// Iterator to `object`, which must be linked into this container
+	iterator iterator_to(T &object)
+	{
+		return iterator(&hookData, static_cast<Hook *>(&object));
+	}
+
+	const_iterator iterator_to(const T &object) const
+	{
+		return const_iterator(&hookData, const_cast<Hook *>(static_cast<const Hook *>(&object)));
+	}
+
+	/// Index of `object`, which must be linked into this container
+	std::size_t index_of(const T &object) const
+	{
+		return hookData.index_of(&object);
+	}
+
+	/// Links `object` (not a copy of it) in at the back
+	void push_back(T &object)
+	{
+		int64_t index = hookData.data.size() - 1;
+		if (index == 0)
+		{
+			insert_at(index, object);
+			return;
+		}
+		// `insert_right()` at the end hook: only the end hook moves, or the bias if the right side
+		// is empty. Taking the end hook's slot and appending it again is cheaper than `deque::insert`.
+		int64_t position = index - hookData.middle - 1;
+		if (position > 0)
+			endHook.pos++;
+		else
+			hookData.rightBias++;
+		Hook *hook = &object;
+		hook->isLeft = false;
+		hook->pos = position - hookData.rightBias;
+		hookData.data.back() = hook;
+		hookData.data.push_back(&endHook);
+	}
+
+	/// Links `object` (not a copy of it) in at the front
+	void push_front(T &object)
+	{
+		insert_at(0, object);
+	}
+
+	/// Links `object` in right before `iterator`
+	iterator insert(const_iterator iterator, T &object)
+	{
+		return insert_at(iterator.get_underlying_index(), object);
+	}
+
+	/// Unlinks the object, returns an iterator to the one that followed it
+	iterator erase(const_iterator iterator)
+	{
+		int64_t index = iterator.get_underlying_index();
+		unlink(index, index + 1);
+		return iterator_at(index);
+	}
+
+	iterator erase(const_iterator first, const_iterator last)
+	{
+		int64_t index = first.get_underlying_index();
+		int64_t lastIndex = last.get_underlying_index();
+		if (index != lastIndex)
+			unlink(index, lastIndex);
+		return iterator_at(index);
+	}
+
+	/// Unlinks `object`, which must be linked into this container
+	void erase(T &object)
+	{
+		int64_t index = hookData.index_of(&object);
+		unlink(index, index + 1);
+	}
+
+	/// Same renumbering as `stable_deque::pop_front()`, i.e. none
+	void pop_front()
+	{
+		assert(!empty());
+		if (hookData.middle >= 0)
+			hookData.middle--;
+		else
+			hookData.rightBias--;
+		hookData.data.pop_front();
+	}
+
+	void pop_back()
+	{
+		assert(!empty());
+		if ((int64_t)hookData.data.size() - 2 > hookData.middle)
+		{
+			endHook.pos--;
+		}
+		else
+		{
+			hookData.leftBias--;
+			hookData.middle--;
+		}
+		hookData.data.pop_back();
+		hookData.data.back() = &endHook;
+	}
+
+	/// Unlinks every object
+	void clear()
+	{
+		hookData.data.clear();
+		hookData.middle = -1;
+		hookData.leftBias = 0;
+		hookData.rightBias = 0;
+		endHook.pos = 0;
+		endHook.isLeft = false;
+		hookData.data.push_back(&endHook);
+	}
+
+	/// Calls `function` on every object in order, walking `intrusive_data::data` directly
+	template <typename Function>
+	void for_each(Function function)
+	{
+		auto last = hookData.data.end() - 1;
+		for (auto iter = hookData.data.begin(); iter != last; ++iter)
+			function(static_cast<T &>(**iter));
+	}
+
+	template <typename Function>
+	void for_each(Function function) const
+	{
+		auto last = hookData.data.end() - 1;
+		for (auto iter = hookData.data.begin(); iter != last; ++iter)
+			function(static_cast<const T &>(**iter));
+	}
+};
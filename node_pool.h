@@ -0,0 +1,260 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/// Chunked node pool used by `stable_deque` and `vector_stable_deque`.
+///
+/// Nodes are carved out of chunks obtained from the container's node allocator. Freed nodes
+/// go onto an intrusive free list (the link is stored inside the dead node) and are handed out
+/// again before any new chunk is touched. Chunks never move, so node addresses stay stable, and
+/// they are only returned to the allocator all at once by `release()`.
+///
+/// The pool does not own an allocator, the container passes its own into every call that can
+/// allocate or free memory.
+///
+/// `allocate_forward()`/`allocate_backward()` keep nodes that are created in logical order next to
+/// each other in memory: the former fills a chunk upwards, the latter a separate chunk downwards.
+/// They only fall back to the free list once their chunk is used up, and only start a new chunk
+/// once the free list is empty too, so at most two chunks sit partially used.
+///
+/// `reserve()` adds one chunk sized to cover a whole burst up front, `shrink()` returns the chunks
+/// none of whose nodes are in use.
+template <typename Node, typename NodeAllocator, std::size_t maxChunkBytes>
+class node_pool
+{
+	using NodeAllocatorTraits = std::allocator_traits<NodeAllocator>;
+
+	struct FreeNode
+	{
+		FreeNode *next;
+	};
+
+	/// Lives in the first slot(s) of every chunk
+	struct ChunkHeader
+	{
+		Node *next;
+		std::size_t slots;
+	};
+
+	static_assert(sizeof(Node) >= sizeof(FreeNode), "node too small to hold a free list link");
+
+	static constexpr std::size_t headerSlots = (sizeof(ChunkHeader) + sizeof(Node) - 1) / sizeof(Node);
+	static constexpr std::size_t minChunkNodes = 8;
+	static constexpr std::size_t maxChunkNodes =
+		maxChunkBytes / sizeof(Node) > minChunkNodes ? maxChunkBytes / sizeof(Node) : minChunkNodes;
+
+	/// Singly linked list of every chunk (newest first)
+	Node *chunks = nullptr;
+	FreeNode *freeList = nullptr;
+
+	/// Untouched tail of the chunk filled upwards
+	Node *bumpCurrent = nullptr;
+	Node *bumpEnd = nullptr;
+
+	/// Untouched head of the chunk filled downwards (by `allocate_backward()`)
+	Node *backBegin = nullptr;
+	Node *backCurrent = nullptr;
+
+	std::size_t nextChunkNodes = minChunkNodes;
+
+	/// Usable nodes and bytes (headers included) of every chunk
+	std::size_t capacityNodes = 0;
+	std::size_t chunkBytes = 0;
+
+	static ChunkHeader *header(Node *chunk)
+	{
+		return std::launder(reinterpret_cast<ChunkHeader *>(chunk));
+	}
+
+	/// Returns the first usable node of a new chunk of `nodes` nodes, `end` is set to one past its last
+	Node *add_chunk(NodeAllocator &allocator, std::size_t nodes, Node *&end)
+	{
+		std::size_t slots = headerSlots + nodes;
+		Node *chunk = NodeAllocatorTraits::allocate(allocator, slots);
+		::new (static_cast<void *>(chunk)) ChunkHeader{chunks, slots};
+		chunks = chunk;
+		capacityNodes += nodes;
+		chunkBytes += slots * sizeof(Node);
+
+		end = chunk + slots;
+		return chunk + headerSlots;
+	}
+
+	/// Chunk of the growing size the allocation functions use
+	Node *add_chunk(NodeAllocator &allocator, Node *&end)
+	{
+		Node *first = add_chunk(allocator, nextChunkNodes, end);
+		if (nextChunkNodes < maxChunkNodes)
+			nextChunkNodes = nextChunkNodes * 2 < maxChunkNodes ? nextChunkNodes * 2 : maxChunkNodes;
+		return first;
+	}
+
+	Node *pop_free_list()
+	{
+		FreeNode *node = freeList;
+		freeList = node->next;
+		return reinterpret_cast<Node *>(node);
+	}
+
+public:
+	node_pool() = default;
+	node_pool(const node_pool &) = delete;
+	node_pool &operator=(const node_pool &) = delete;
+
+	/// Exchanges every chunk with `other`. Both pools must belong to containers whose node
+	/// allocators can free each other's memory (or that swap their allocators too).
+	void swap(node_pool &other) noexcept
+	{
+		std::swap(chunks, other.chunks);
+		std::swap(freeList, other.freeList);
+		std::swap(bumpCurrent, other.bumpCurrent);
+		std::swap(bumpEnd, other.bumpEnd);
+		std::swap(backBegin, other.backBegin);
+		std::swap(backCurrent, other.backCurrent);
+		std::swap(nextChunkNodes, other.nextChunkNodes);
+		std::swap(capacityNodes, other.capacityNodes);
+		std::swap(chunkBytes, other.chunkBytes);
+	}
+
+	/// Returns uninitialized storage for one `Node`
+	Node *allocate(NodeAllocator &allocator)
+	{
+		if (freeList != nullptr)
+			return pop_free_list();
+		if (bumpCurrent == bumpEnd) [[unlikely]]
+			bumpCurrent = add_chunk(allocator, bumpEnd);
+		return bumpCurrent++;
+	}
+
+	/// Like `allocate()`, but prefers the slot right after the previous `allocate_forward()`
+	Node *allocate_forward(NodeAllocator &allocator)
+	{
+		if (bumpCurrent != bumpEnd) [[likely]]
+			return bumpCurrent++;
+		if (freeList != nullptr)
+			return pop_free_list();
+		bumpCurrent = add_chunk(allocator, bumpEnd);
+		return bumpCurrent++;
+	}
+
+	/// Like `allocate()`, but prefers the slot right before the previous `allocate_backward()`
+	Node *allocate_backward(NodeAllocator &allocator)
+	{
+		if (backCurrent != backBegin) [[likely]]
+			return --backCurrent;
+		if (freeList != nullptr)
+			return pop_free_list();
+		backBegin = add_chunk(allocator, backCurrent);
+		return --backCurrent;
+	}
+
+	/// Takes back storage of an already destroyed `Node`
+	void deallocate(Node *node)
+	{
+		freeList = ::new (static_cast<void *>(node)) FreeNode{freeList};
+	}
+
+	/// Nodes the chunks can hold, in use or not
+	std::size_t capacity() const
+	{
+		return capacityNodes;
+	}
+
+	/// Bytes taken from the allocator, chunk headers included
+	std::size_t allocated_bytes() const
+	{
+		return chunkBytes;
+	}
+
+	/// Grows `capacity()` to at least `nodes` with a single chunk, whose nodes go onto the free list
+	/// in address order
+	void reserve(NodeAllocator &allocator, std::size_t nodes)
+	{
+		if (nodes <= capacityNodes)
+			return;
+		Node *end;
+		Node *first = add_chunk(allocator, nodes - capacityNodes, end);
+		while (end != first)
+			deallocate(--end);
+	}
+
+	/// Frees every chunk that holds no node in use. Nodes in use keep their address.
+	void shrink(NodeAllocator &allocator)
+	{
+		using ChunkAllocator = typename NodeAllocatorTraits::template rebind_alloc<Node *>;
+		using CountAllocator = typename NodeAllocatorTraits::template rebind_alloc<std::size_t>;
+
+		// Chunks sorted by address, so every idle node maps to its chunk with a binary search
+		std::vector<Node *, ChunkAllocator> sorted{ChunkAllocator(allocator)};
+		for (Node *chunk = chunks; chunk != nullptr; chunk = header(chunk)->next)
+			sorted.push_back(chunk);
+		std::sort(sorted.begin(), sorted.end(), std::less<Node *>());
+		auto chunk_of = [&](const void *node) {
+			return std::upper_bound(sorted.begin(), sorted.end(), static_cast<const Node *>(node), std::less<const Node *>()) - sorted.begin() - 1;
+		};
+
+		std::vector<std::size_t, CountAllocator> idle(sorted.size(), 0, CountAllocator(allocator));
+		for (FreeNode *node = freeList; node != nullptr; node = node->next)
+			idle[chunk_of(node)]++;
+		if (bumpCurrent != bumpEnd)
+			idle[chunk_of(bumpCurrent)] += bumpEnd - bumpCurrent;
+		if (backCurrent != backBegin)
+			idle[chunk_of(backBegin)] += backCurrent - backBegin;
+
+		auto is_idle = [&](std::ptrdiff_t index) { return idle[index] == header(sorted[index])->slots - headerSlots; };
+
+		// Unlink the free nodes of idle chunks, keeping the order of the rest
+		FreeNode **link = &freeList;
+		while (*link != nullptr)
+		{
+			if (is_idle(chunk_of(*link)))
+				*link = (*link)->next;
+			else
+				link = &(*link)->next;
+		}
+		if (bumpCurrent != bumpEnd && is_idle(chunk_of(bumpCurrent)))
+			bumpCurrent = bumpEnd = nullptr;
+		if (backCurrent != backBegin && is_idle(chunk_of(backBegin)))
+			backBegin = backCurrent = nullptr;
+
+		Node **chunkLink = &chunks;
+		while (*chunkLink != nullptr)
+		{
+			Node *chunk = *chunkLink;
+			ChunkHeader *chunkHeader = header(chunk);
+			if (!is_idle(chunk_of(chunk)))
+			{
+				chunkLink = &chunkHeader->next;
+				continue;
+			}
+			*chunkLink = chunkHeader->next;
+			capacityNodes -= chunkHeader->slots - headerSlots;
+			chunkBytes -= chunkHeader->slots * sizeof(Node);
+			NodeAllocatorTraits::deallocate(allocator, chunk, chunkHeader->slots);
+		}
+		if (chunks == nullptr)
+			nextChunkNodes = minChunkNodes;
+	}
+
+	/// Frees every chunk. Every node handed out by this pool must have been destroyed before.
+	void release(NodeAllocator &allocator)
+	{
+		while (chunks != nullptr)
+		{
+			Node *chunk = chunks;
+			ChunkHeader *chunkHeader = header(chunk);
+			chunks = chunkHeader->next;
+			NodeAllocatorTraits::deallocate(allocator, chunk, chunkHeader->slots);
+		}
+		freeList = nullptr;
+		bumpCurrent = bumpEnd = nullptr;
+		backBegin = backCurrent = nullptr;
+		nextChunkNodes = minChunkNodes;
+		capacityNodes = chunkBytes = 0;
+	}
+};
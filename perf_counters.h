@@ -0,0 +1,140 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/// Hardware counters around a measured region, through `perf_event_open` on Linux.
+///
+/// Every event is opened on its own, so a machine (or VM) that lacks one of them still reports the
+/// others. When none can be opened (not Linux, `perf_event_paranoid` too strict, no PMU in the
+/// container), `available()` is false, `start()`/`stop()` do nothing and every reading is empty.
+class perf_counters
+{
+public:
+	enum Event
+	{
+		Instructions,
+		BranchMisses,
+		L1dReadMisses,
+		LlcReadMisses,
+		EventCount
+	};
+
+	static constexpr std::array<const char *, EventCount> eventNames = { "instr", "br-miss", "L1d-miss", "LLC-miss" };
+
+	/// One value per event, empty if the event couldn't be counted
+	using Reading = std::array<std::optional<uint64_t>, EventCount>;
+
+private:
+	std::array<int, EventCount> fds;
+
+#if defined(__linux__)
+	static int open_event(uint32_t type, uint64_t config)
+	{
+		perf_event_attr attr{};
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		// Threads started inside a measured region count too, once they have exited
+		attr.inherit = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	static constexpr uint64_t cache_read_miss(uint64_t cache)
+	{
+		return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	}
+#endif
+
+public:
+	perf_counters()
+	{
+		fds.fill(-1);
+#if defined(__linux__)
+		fds[Instructions] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		fds[BranchMisses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+		fds[L1dReadMisses] = open_event(PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_L1D));
+		fds[LlcReadMisses] = open_event(PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_LL));
+#endif
+	}
+
+	perf_counters(const perf_counters &) = delete;
+	perf_counters &operator=(const perf_counters &) = delete;
+
+	~perf_counters()
+	{
+#if defined(__linux__)
+		for (int fd : fds)
+			if (fd >= 0)
+				close(fd);
+#endif
+	}
+
+	bool available() const
+	{
+		for (int fd : fds)
+			if (fd >= 0)
+				return true;
+		return false;
+	}
+
+	void start()
+	{
+#if defined(__linux__)
+		for (int fd : fds)
+			if (fd >= 0)
+			{
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+#endif
+	}
+
+	/// Stops counting and returns what was counted since `start()`
+	Reading stop()
+	{
+		Reading reading;
+#if defined(__linux__)
+		for (int fd : fds)
+			if (fd >= 0)
+				ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		for (int event = 0; event < EventCount; event++)
+		{
+			uint64_t values[3]{};
+			if (fds[event] < 0 || read(fds[event], values, sizeof(values)) != sizeof(values) || values[2] == 0)
+				continue;
+			// Scale up if the kernel had to multiplex the counter
+			reading[event] = values[2] == values[1] ? values[0] : (uint64_t)((double)values[0] * values[1] / values[2]);
+		}
+#endif
+		return reading;
+	}
+
+	/// "12.3 instr, 0.01 br-miss, ..." per `operations`, leaving out events that weren't counted
+	static std::string per_operation(const Reading &reading, uint64_t operations)
+	{
+		std::string text;
+		for (int event = 0; event < EventCount; event++)
+		{
+			if (!reading[event])
+				continue;
+			char value[32];
+			std::snprintf(value, sizeof(value), "%.2f", (double)*reading[event] / (double)(operations ? operations : 1));
+			text += (text.empty() ? "" : ", ") + std::string(value) + ' ' + eventNames[event];
+		}
+		return text;
+	}
+};
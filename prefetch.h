@@ -0,0 +1,20 @@
+#pragma once
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+/// Hints the CPU to start loading the cache line at `address` for reading.
+/// Only a hint, so any address (even one that is never read) is fine.
+inline void prefetch_for_read(const void *address)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+#if defined(_M_ARM64)
+	__prefetch(address);
+#else
+	_mm_prefetch(static_cast<const char *>(address), _MM_HINT_T0);
+#endif
+#else
+	__builtin_prefetch(address, 0, 3);
+#endif
+}
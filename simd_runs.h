@@ -0,0 +1,142 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// The two loops behind `stable_deque_options::slot_positions` renumbering. Both use AVX2 when the
+// build targets it or (GCC/Clang) the CPU turns out to have it, SSE2 on any other x86-64 and a
+// plain loop elsewhere.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define STABLE_DEQUE_X86_64 1
+// Without -mavx2 (/arch:AVX2), GCC and Clang still build an AVX2 version and pick it at runtime
+#if !defined(__AVX2__) && (defined(__GNUC__) || defined(__clang__))
+#define STABLE_DEQUE_AVX2_DISPATCH 1
+#endif
+#endif
+
+#if defined(STABLE_DEQUE_AVX2_DISPATCH)
+#define STABLE_DEQUE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define STABLE_DEQUE_TARGET_AVX2
+#endif
+
+namespace simd_runs_detail
+{
+
+inline void add_scalar(int64_t *values, std::size_t count, int64_t amount)
+{
+	for (std::size_t i = 0; i < count; i++)
+		values[i] += amount;
+}
+
+inline std::size_t run_scalar(const uint32_t *values, std::size_t count, int64_t first, int64_t step)
+{
+	std::size_t i = 0;
+	for (; i < count && values[i] == (uint32_t)first; i++)
+		first += step;
+	return i;
+}
+
+#if defined(STABLE_DEQUE_X86_64)
+inline void add_sse2(int64_t *values, std::size_t count, int64_t amount)
+{
+	__m128i add = _mm_set1_epi64x(amount);
+	std::size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		__m128i *lane = reinterpret_cast<__m128i *>(values + i);
+		_mm_storeu_si128(lane, _mm_add_epi64(_mm_loadu_si128(lane), add));
+	}
+	add_scalar(values + i, count - i, amount);
+}
+
+inline std::size_t run_sse2(const uint32_t *values, std::size_t count, int64_t first, int64_t step)
+{
+	__m128i expected = _mm_setr_epi32((int)first, (int)(first + step), (int)(first + 2 * step), (int)(first + 3 * step));
+	__m128i next = _mm_set1_epi32((int)(4 * step));
+	std::size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i lane = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(lane, expected)) != 0xFFFF)
+			break;
+		expected = _mm_add_epi32(expected, next);
+	}
+	return i + run_scalar(values + i, count - i, first + (int64_t)i * step, step);
+}
+#endif
+
+#if defined(__AVX2__) || defined(STABLE_DEQUE_AVX2_DISPATCH)
+STABLE_DEQUE_TARGET_AVX2
+inline void add_avx2(int64_t *values, std::size_t count, int64_t amount)
+{
+	__m256i add = _mm256_set1_epi64x(amount);
+	std::size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i *low = reinterpret_cast<__m256i *>(values + i);
+		__m256i *high = reinterpret_cast<__m256i *>(values + i + 4);
+		_mm256_storeu_si256(low, _mm256_add_epi64(_mm256_loadu_si256(low), add));
+		_mm256_storeu_si256(high, _mm256_add_epi64(_mm256_loadu_si256(high), add));
+	}
+	add_scalar(values + i, count - i, amount);
+}
+
+STABLE_DEQUE_TARGET_AVX2
+inline std::size_t run_avx2(const uint32_t *values, std::size_t count, int64_t first, int64_t step)
+{
+	__m256i expected = _mm256_add_epi32(_mm256_set1_epi32((int)first), _mm256_mullo_epi32(_mm256_set1_epi32((int)step), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+	__m256i next = _mm256_set1_epi32((int)(8 * step));
+	std::size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i lane = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(lane, expected)) != -1)
+			break;
+		expected = _mm256_add_epi32(expected, next);
+	}
+	return i + run_scalar(values + i, count - i, first + (int64_t)i * step, step);
+}
+#endif
+
+#if defined(STABLE_DEQUE_AVX2_DISPATCH)
+// Initialized before `main()`, which may be before libgcc filled in the CPU features
+inline const bool hasAvx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+#endif
+
+}
+
+/// Adds `amount` to each of the `count` values at `values`
+inline void add_to_each(int64_t *values, std::size_t count, int64_t amount)
+{
+#if defined(__AVX2__)
+	simd_runs_detail::add_avx2(values, count, amount);
+#elif defined(STABLE_DEQUE_AVX2_DISPATCH)
+	if (simd_runs_detail::hasAvx2)
+		simd_runs_detail::add_avx2(values, count, amount);
+	else
+		simd_runs_detail::add_sse2(values, count, amount);
+#elif defined(STABLE_DEQUE_X86_64)
+	simd_runs_detail::add_sse2(values, count, amount);
+#else
+	simd_runs_detail::add_scalar(values, count, amount);
+#endif
+}
+
+/// How many of the `count` values at `values` continue `first, first + step, first + 2 * step, ...`,
+/// compared modulo 2^32 like the values themselves
+inline std::size_t run_length(const uint32_t *values, std::size_t count, int64_t first, int64_t step)
+{
+#if defined(__AVX2__)
+	return simd_runs_detail::run_avx2(values, count, first, step);
+#elif defined(STABLE_DEQUE_AVX2_DISPATCH)
+	if (simd_runs_detail::hasAvx2)
+		return simd_runs_detail::run_avx2(values, count, first, step);
+	return simd_runs_detail::run_sse2(values, count, first, step);
+#elif defined(STABLE_DEQUE_X86_64)
+	return simd_runs_detail::run_sse2(values, count, first, step);
+#else
+	return simd_runs_detail::run_scalar(values, count, first, step);
+#endif
+}
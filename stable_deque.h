@@ -1,361 +1,2105 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
 #include <deque>
 #include <memory>
 #include <cassert>
+#include <optional>
+#include <iterator>
+#include <memory_resource>
+#include <ranges>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-template <typename T, typename Allocator = std::allocator<T>>
+#include "node_pool.h"
+#include "prefetch.h"
+#include "simd_runs.h"
+#include "stable_deque_options.h"
+#include "stable_deque_stats.h"
+#include "tombstone_ranks.h"
+
+template <typename T, typename Allocator = std::allocator<T>, typename Options = stable_deque_options>
 class stable_deque
 {
-	struct Node
+	static constexpr int64_t blockSize = Options::position_block_size;
+	static constexpr bool blockedPositions = blockSize > 0;
+	static constexpr bool slotPositions = Options::slot_positions;
+	static constexpr bool collectStats = Options::collect_stats;
+	static constexpr bool tombstones = Options::tombstone_erase;
+	static_assert(!(blockedPositions && slotPositions), "position_block_size and slot_positions can't be combined");
+
+	/// A run of neighbouring nodes on one side (only with `Options::position_block_size`).
+	/// Its nodes store `pos` relative to `base` and use the offsets [begin, end), innermost first.
+	struct Block
 	{
-		T data;
+		int64_t base;
+		int64_t begin;
+		int64_t end;
+	};
+
+	struct Unused
+	{
+		Unused() = default;
+
+		/// Stands in for members that are built from the container's allocator
+		explicit Unused(const Allocator &)
+		{
+		}
+	};
+
+	/// Stands in for `NodeBase::dead` without `Options::tombstone_erase`, a type of its own so it
+	/// can share its address with the `Unused` base
+	struct NoTombstones
+	{
+	};
+
+	struct BlockLink
+	{
+		Block *block = nullptr;
+	};
+
+	/// Everything the structure needs to know about a node. The end node is only a `NodeBase`,
+	/// so it never holds (or constructs) a `T`.
+	struct NodeBase : std::conditional_t<blockedPositions, BlockLink, Unused>
+	{
+		/// With `Options::slot_positions` this is the node's slot in `SlotTable::positions`
 		int64_t pos;
+
+		/// With `Options::tombstone_erase`: the element was erased, the node waits for `compact()`
+		[[no_unique_address]] std::conditional_t<tombstones, bool, NoTombstones> dead{};
+	};
+
+	struct Node : NodeBase
+	{
+		T data;
+
+		/// Constructs `data` in place from `args`
+		template <typename... Args>
+		Node(int64_t pos, Args &&...args) : NodeBase{{}, pos}, data(std::forward<Args>(args)...)
+		{
+		}
 	};
 
-	using NodePAllocator = std::allocator_traits<Allocator>::template rebind_alloc<Node *>;
+	using NodePAllocator = std::allocator_traits<Allocator>::template rebind_alloc<NodeBase *>;
 	using NodePAllocatorTraits = std::allocator_traits<NodePAllocator>;
+	using NodesDequeAllocator = std::conditional_t<collectStats, stats_counting_allocator<NodePAllocator, NodeBase *>, NodePAllocator>;
 
+	using AllocatorTraits = std::allocator_traits<Allocator>;
 	using NodeAllocator = std::allocator_traits<Allocator>::template rebind_alloc<Node>;
 	using NodeAllocatorTraits = std::allocator_traits<NodeAllocator>;
 	NodeAllocator nodeAllocator;
 
+	/// Only used with `Options::pooled_nodes`
+	node_pool<Node, NodeAllocator, Options::pool_chunk_bytes> nodePool;
+
+	using BlockAllocator = std::allocator_traits<Allocator>::template rebind_alloc<Block>;
+	using BlockAllocatorTraits = std::allocator_traits<BlockAllocator>;
+
+	/// Only used with `Options::position_block_size`
+	std::conditional_t<blockedPositions, BlockAllocator, Unused> blockAllocator;
+	std::conditional_t<blockedPositions, node_pool<Block, BlockAllocator, Options::pool_chunk_bytes>, Unused> blockPool;
+
+	using Slot = uint32_t;
+	using PositionAllocator = std::allocator_traits<Allocator>::template rebind_alloc<int64_t>;
+	using SlotAllocator = std::allocator_traits<Allocator>::template rebind_alloc<Slot>;
+
+	/// Only used with `Options::slot_positions`
+	struct SlotTable
+	{
+		/// Indexed by slot, holds what `NodeBase::pos` holds otherwise
+		std::vector<int64_t, PositionAllocator> positions;
+
+		/// Slot of every node, parallel to `stable_deque_data::data`, so renumbering a range never loads a node
+		std::deque<Slot, SlotAllocator> slots;
+
+		std::vector<Slot, SlotAllocator> freeSlots;
+
+		/// Positions shifted outside of a long run of consecutive slots since the last `renumber()`
+		int64_t scattered = 0;
+
+		explicit SlotTable(const Allocator &allocator) :
+			positions(PositionAllocator(allocator)), slots(SlotAllocator(allocator)), freeSlots(SlotAllocator(allocator))
+		{
+		}
+	};
+
 	struct stable_deque_data
 	{
 		int64_t middle = -1;
 
+		/// Offsets added to every `Node::pos` (or `Block::base`) of a side.
+		/// Shifting a whole side (e.g. erasing the node next to `middle`) only
+		/// needs to update these instead of walking every node of that side.
+		int64_t leftBias = 0;
+		int64_t rightBias = 0;
+
+		/// Only used with `Options::collect_stats`. On the heap, so `data`'s allocator can point to it.
+		std::conditional_t<collectStats, std::unique_ptr<stable_deque_stats>, Unused> stats;
+
 		/// Data is stored in this order (relative to the provided iterator):
 		///[begin(), middle](middle, end())
-		std::deque<Node*, NodePAllocator> data;
+		std::deque<NodeBase*, NodesDequeAllocator> data;
+
+		std::conditional_t<slotPositions, SlotTable, Unused> slotTable;
+
+		/// Only used with `Options::tombstone_erase`. Tombstones in `data`, never its first or last node.
+		std::conditional_t<tombstones, int64_t, Unused> deadCount{};
+
+		/// Only used with `Options::tombstone_erase`, built by the first tombstone and kept while any exist
+		std::conditional_t<tombstones, tombstone_ranks<PositionAllocator>, Unused> ranks;
+
+		static bool is_dead(const NodeBase *node)
+		{
+			if constexpr (tombstones)
+				return node->dead;
+			else
+				return false;
+		}
+
+		/// Index of the node `offset` live nodes away from the one at `index`, stepping over tombstones.
+		/// Only while tombstones exist.
+		int64_t live_index(int64_t index, int64_t offset) const
+		{
+			// `++`/`--` mostly find a live neighbour within a few nodes, without going through `ranks`
+			if (offset == 1 || offset == -1)
+			{
+				int64_t next = index + offset;
+				for (int i = 0; i < 8; i++, next += offset)
+					if (!is_dead(data[next]))
+						return next;
+			}
+			return ranks.index_of(ranks.live_before(index) + offset);
+		}
+
+		/// Live nodes stored in [first, last) of `data`. Only while tombstones exist.
+		int64_t live_count(int64_t first, int64_t last) const
+		{
+			return ranks.live_before(last) - ranks.live_before(first);
+		}
+
+		explicit stable_deque_data(const Allocator &allocator) :
+			data(nodes_deque_allocator(allocator)), slotTable(allocator), ranks(allocator)
+		{
+		}
+
+		/// Creates `stats` first with `Options::collect_stats`, `data` is built with this
+		NodesDequeAllocator nodes_deque_allocator(const Allocator &allocator)
+		{
+			if constexpr (collectStats)
+			{
+				stats = std::make_unique<stable_deque_stats>();
+				return NodesDequeAllocator(stats.get(), NodePAllocator(allocator));
+			}
+			else
+			{
+				return NodesDequeAllocator(allocator);
+			}
+		}
+
+		/// Distance from `middle` of the node, without the side bias
+		int64_t unbiased_pos(const NodeBase *node) const
+		{
+			if constexpr (blockedPositions)
+				return node->block->base + node->pos;
+			else if constexpr (slotPositions)
+				return slotTable.positions[node->pos];
+			else
+				return node->pos;
+		}
 	} nodeData;
 
-	class iterator
+	/// Sentinel returned by `end()`, always the last entry of `stable_deque_data::data`
+	NodeBase endNode;
+
+	template <bool isConst>
+	class basic_iterator
 	{
 		friend class stable_deque;
+		template <bool>
+		friend class basic_iterator;
+
+		using DataPointer = std::conditional_t<isConst, const stable_deque_data *, stable_deque_data *>;
 
 		/// Context/parent
-		stable_deque_data &nodeDataRef;
+		DataPointer nodeDataPtr = nullptr;
 
 		/// Boolean controlling if we are an iterator on the 'left' or 'right' side
 		/// (left or right is assuming stable_deque_data::data is visualized linearly)
-		bool isLeft;
+		bool isLeft = false;
 
 		/// Current node our iterator is operating on
-		Node *node;
+		NodeBase *node = nullptr;
+
+		basic_iterator(DataPointer nodeDataPtr, bool isLeft, NodeBase *node) : nodeDataPtr(nodeDataPtr), isLeft(isLeft), node(node)
+		{
+		}
 
-		iterator(stable_deque_data &nodeDataRef, bool isLeft, Node *node) : nodeDataRef(nodeDataRef), isLeft(isLeft), node(node)
+		/// Distance from `middle` of the node (with the side bias applied)
+		int64_t pos() const
 		{
+			return nodeDataPtr->unbiased_pos(node) + (isLeft ? nodeDataPtr->leftBias : nodeDataPtr->rightBias);
 		}
 
-		std::deque<Node*, NodePAllocator>::iterator get_underlying_data_iterator() const
+		/// Index of the node inside `stable_deque_data::data`
+		int64_t get_underlying_index() const
 		{
 			if (isLeft)
-				return nodeDataRef.data.begin() + (nodeDataRef.middle - node->pos);
+				return nodeDataPtr->middle - pos();
 			else
-				return nodeDataRef.data.begin() + (nodeDataRef.middle + 1 + node->pos);
+				return nodeDataPtr->middle + 1 + pos();
+		}
+
+		auto get_underlying_data_iterator() const
+		{
+			return nodeDataPtr->data.begin() + get_underlying_index();
 		}
 
 	public:
-		iterator(const iterator &iter) : nodeDataRef(iter.nodeDataRef), isLeft(iter.isLeft), node(iter.node)
+		using iterator_category = std::random_access_iterator_tag;
+		using iterator_concept = std::random_access_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = std::conditional_t<isConst, const T *, T *>;
+		using reference = std::conditional_t<isConst, const T &, T &>;
+
+		basic_iterator() = default;
+		basic_iterator(const basic_iterator &) = default;
+		basic_iterator &operator=(const basic_iterator &) = default;
+
+		/// `iterator` converts to `const_iterator`
+		template <bool wasConst>
+			requires(isConst && !wasConst)
+		basic_iterator(const basic_iterator<wasConst> &iter) : nodeDataPtr(iter.nodeDataPtr), isLeft(iter.isLeft), node(iter.node)
+		{
+		}
+
+		reference operator*() const
 		{
+			return static_cast<Node *>(node)->data;
 		}
 
-		T &operator*() const
+		pointer operator->() const
 		{
-			return node->data;
+			return &static_cast<Node *>(node)->data;
 		}
 
 		// Increment / Decrement
-		iterator &operator++()
+		basic_iterator &operator++()
 		{
 			*this += 1;
 			return *this;
 		}
 
-		iterator &operator++(int)
+		basic_iterator operator++(int)
 		{
+			basic_iterator tmp(*this);
 			*this += 1;
-			return *this;
+			return tmp;
 		}
 
-		iterator &operator--()
+		basic_iterator &operator--()
 		{
 			*this -= 1;
 			return *this;
 		}
 
-		iterator &operator--(int)
+		basic_iterator operator--(int)
 		{
+			basic_iterator tmp(*this);
 			*this -= 1;
-			return *this;
+			return tmp;
 		}
 
-		/// Positive offset means adding an element closer to the "right" side
-		iterator &operator+=(int64_t offset)
+		/// Positive offset means moving closer to the "right" side
+		basic_iterator &operator+=(difference_type offset)
 		{
-			int64_t locationToIndex;
-			if (isLeft)
-			{
-				locationToIndex = node->pos - offset;
-
-				// Switch sides
-				if (locationToIndex < 0)
-					this->isLeft = !this->isLeft;
-				this->node = nodeDataRef.data[nodeDataRef.middle - locationToIndex];
-			}
-			else
+			int64_t index = get_underlying_index() + offset;
+			if constexpr (tombstones)
 			{
-				locationToIndex = node->pos + offset;
-
-				// Switch sides
-				if (locationToIndex < 0)
-					this->isLeft = !this->isLeft;
-				this->node = nodeDataRef.data[nodeDataRef.middle + 1 + locationToIndex];
+				if (nodeDataPtr->deadCount > 0) [[unlikely]]
+					index = nodeDataPtr->live_index(index - offset, offset);
 			}
+			// Switches sides when crossing `middle`
+			bool wasLeft = isLeft;
+			isLeft = index <= nodeDataPtr->middle;
+			if constexpr (collectStats)
+				nodeDataPtr->stats->iterator_side_switches += wasLeft != isLeft;
+			node = nodeDataPtr->data[index];
 			return *this;
 		}
 
-		iterator &operator-=(int64_t offset)
+		basic_iterator &operator-=(difference_type offset)
 		{
 			*this += -offset;
 			return *this;
 		}
 
-		friend iterator operator+(const iterator &left, int64_t offset)
+		friend basic_iterator operator+(const basic_iterator &left, difference_type offset)
 		{
-			iterator tmp(left);
+			basic_iterator tmp(left);
 			tmp += offset;
 			return tmp;
 		}
 
-		friend iterator operator+(int64_t offset, const iterator &right)
+		friend basic_iterator operator+(difference_type offset, const basic_iterator &right)
 		{
-			iterator tmp(right);
+			basic_iterator tmp(right);
 			tmp += offset;
 			return tmp;
 		}
 
-		friend iterator operator-(const iterator &left, int64_t offset)
+		friend basic_iterator operator-(const basic_iterator &left, difference_type offset)
 		{
-			iterator tmp(left);
+			basic_iterator tmp(left);
 			tmp -= offset;
 			return tmp;
 		}
 
+		friend difference_type operator-(const basic_iterator &left, const basic_iterator &right)
+		{
+			int64_t leftIndex = left.get_underlying_index();
+			int64_t rightIndex = right.get_underlying_index();
+			if constexpr (tombstones)
+			{
+				if (left.nodeDataPtr->deadCount > 0) [[unlikely]]
+				{
+					if (leftIndex >= rightIndex)
+						return left.nodeDataPtr->live_count(rightIndex, leftIndex);
+					return -left.nodeDataPtr->live_count(leftIndex, rightIndex);
+				}
+			}
+			return leftIndex - rightIndex;
+		}
+
 		// Comparison operators
-		friend bool operator==(const iterator &l, const iterator &r)
+		friend bool operator==(const basic_iterator &l, const basic_iterator &r)
 		{
 			return l.node == r.node;
 		}
 
-		friend bool operator!=(const iterator &l, const iterator &r)
+		friend bool operator!=(const basic_iterator &l, const basic_iterator &r)
 		{
 			return l.node != r.node;
 		}
 
-		friend bool operator<(const iterator &l, const iterator &r)
+		friend bool operator<(const basic_iterator &l, const basic_iterator &r)
 		{
-			return l.isLeft == true && r.isLeft == false || l.node->pos < r.node->pos && l.isLeft == r.isLeft;
+			return l.get_underlying_index() < r.get_underlying_index();
 		}
 
-		friend bool operator<=(const iterator &l, const iterator &r)
+		friend bool operator<=(const basic_iterator &l, const basic_iterator &r)
 		{
-			return l.isLeft == true && r.isLeft == false || l.node->pos <= r.node->pos && l.isLeft == r.isLeft;
+			return l.get_underlying_index() <= r.get_underlying_index();
 		}
 
-		friend bool operator>(const iterator &l, const iterator &r)
+		friend bool operator>(const basic_iterator &l, const basic_iterator &r)
 		{
-			return !(l.node->pos < r.node->pos) && l != r;
+			return l.get_underlying_index() > r.get_underlying_index();
 		}
 
-		friend bool operator>=(const iterator &l, const iterator &r)
+		friend bool operator>=(const basic_iterator &l, const basic_iterator &r)
 		{
-			return !(l.node->pos < r.node->pos) || l == r;
+			return l.get_underlying_index() >= r.get_underlying_index();
 		}
 
 		// Other
-		T &operator[](int64_t offset) const
+		reference operator[](difference_type offset) const
 		{
 			return *(*this + offset);
 		}
 	};
 
-	// Completes a `amountToShiftEachPointer` for the direction `directionToIterate`.
-	// `amountToShiftEachPointer` is inclusive to `end`.
-	template <int amountToIterateTheFixingLoop, int amountToShiftEachPointer>
-	void fix_up_pointers(iterator iter, iterator end)
+public:
+	using value_type = T;
+	using allocator_type = Allocator;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using reference = T &;
+	using const_reference = const T &;
+	using pointer = T *;
+	using const_pointer = const T *;
+	using iterator = basic_iterator<false>;
+	using const_iterator = basic_iterator<true>;
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+private:
+
+	// Shifts `pos` of every node stored in `[first, last)` of `stable_deque_data::data`.
+	// Walks the underlying deque directly, so only the nodes that really move are touched.
+	void fix_up_pointers(int64_t first, int64_t last, int64_t amountToShiftEachPointer)
 	{
-		while (true)
+		if constexpr (collectStats)
+			nodeData.stats->record_fix_up(last - first);
+		if constexpr (slotPositions)
 		{
-			iter.node->pos += amountToShiftEachPointer;
-			if (iter == end)
-				return;
-			iter += amountToIterateTheFixingLoop;
+			shift_slot_positions(first, last, amountToShiftEachPointer);
+			return;
 		}
+		auto end = nodeData.data.begin() + last;
+		for (auto iter = nodeData.data.begin() + first; iter != end; ++iter)
+			(*iter)->pos += amountToShiftEachPointer;
 	}
 
-	void shared_init()
+	/// Where a new node should go in memory, only matters with `Options::ordered_node_placement`
+	enum class NodePlacement
 	{
-		// Add end node
-		Node *newNode = NodeAllocatorTraits::allocate(nodeAllocator, 1);
-		NodeAllocatorTraits::construct(
-			nodeAllocator,
-			newNode,
-			*((T *)alloca(sizeof(T))), // Garbage memory
-			0);
-		nodeData.data.push_back(newNode);
-	}
+		/// Anywhere (middle inserts)
+		Any,
+		/// Right after the previous forward node (`push_back`, ranges)
+		Forward,
+		/// Right before the previous backward node (`push_front`)
+		Backward
+	};
 
-	enum class InsertInnerOptions
+	template <NodePlacement placement>
+	Node *allocate_node()
 	{
-		None,
-		ForceLeft,
-		ForceRight
-	};
+		if constexpr (collectStats)
+			nodeData.stats->node_allocations++;
+		if constexpr (Options::pooled_nodes && Options::ordered_node_placement && placement == NodePlacement::Forward)
+			return nodePool.allocate_forward(nodeAllocator);
+		else if constexpr (Options::pooled_nodes && Options::ordered_node_placement && placement == NodePlacement::Backward)
+			return nodePool.allocate_backward(nodeAllocator);
+		else if constexpr (Options::pooled_nodes)
+			return nodePool.allocate(nodeAllocator);
+		else
+			return NodeAllocatorTraits::allocate(nodeAllocator, 1);
+	}
 
-	// Insert on the left side of the deque
-	void insert_left(const iterator &iter, const T &value)
+	void destroy_node(Node *node)
 	{
-		if (nodeData.middle == -1) [[unlikely]]
+		if constexpr (collectStats)
+			nodeData.stats->node_frees++;
+		bool alive = true;
+		if constexpr (tombstones)
 		{
-			Node *newNode = NodeAllocatorTraits::allocate(nodeAllocator, 1);
-			NodeAllocatorTraits::construct(nodeAllocator, newNode, value, nodeData.middle);
-			nodeData.data.insert(iter.get_underlying_data_iterator(), newNode);
-			nodeData.middle += 1;
-			fix_up_pointers<1, 1>(iter - 1, begin());
+			// A tombstone's element is already destroyed
+			alive = !node->dead;
+			nodeData.deadCount -= !alive;
 		}
+		if (alive)
+			NodeAllocatorTraits::destroy(nodeAllocator, node);
+		if constexpr (Options::pooled_nodes)
+			nodePool.deallocate(node);
 		else
-		{
-			Node *newNode = NodeAllocatorTraits::allocate(nodeAllocator, 1);
-			NodeAllocatorTraits::construct(nodeAllocator, newNode, value, iter.node->pos);
-			nodeData.data.insert(iter.get_underlying_data_iterator(), newNode);
-			nodeData.middle += 1;
-			fix_up_pointers<1, 1>(iter - 1, begin());
-		}
+			NodeAllocatorTraits::deallocate(nodeAllocator, node, 1);
 	}
 
-	void insert_right(const iterator &iter, const T &value)
+	/// Allocates a node and constructs its `T` from `args`. The caller assigns `pos`.
+	template <NodePlacement placement = NodePlacement::Any, typename... Args>
+	Node *create_node(Args &&...args)
 	{
-		if (nodeData.data.back()->pos == 0) [[unlikely]]
+		Node *newNode = allocate_node<placement>();
+		try
 		{
-			Node *newNode = NodeAllocatorTraits::allocate(nodeAllocator, 1);
-			NodeAllocatorTraits::construct(nodeAllocator, newNode, value, iter.node->pos);
-			nodeData.data.insert(iter.get_underlying_data_iterator(), newNode);
-			fix_up_pointers<1, 1>(iter, end());
+			NodeAllocatorTraits::construct(nodeAllocator, newNode, 0, std::forward<Args>(args)...);
 		}
-		else
+		catch (...)
 		{
-			Node *newNode = NodeAllocatorTraits::allocate(nodeAllocator, 1);
-			NodeAllocatorTraits::construct(nodeAllocator, newNode, value, iter.node->pos);
-			nodeData.data.insert(iter.get_underlying_data_iterator(), newNode);
-			fix_up_pointers<1, 1>(iter, end());
+			if constexpr (Options::pooled_nodes)
+				nodePool.deallocate(newNode);
+			else
+				NodeAllocatorTraits::deallocate(nodeAllocator, newNode, 1);
+			throw;
 		}
+		return newNode;
 	}
-	template <InsertInnerOptions options>
-	void insert_inner(const iterator &iter, const T &value)
+
+	// Slot mode (`Options::slot_positions`) helpers
+
+	/// Runs of consecutive slots shorter than this are shifted slot by slot
+	static constexpr int64_t minSlotRun = 8;
+
+	/// Slots copied out of `SlotTable::slots` at a time, so runs are found in a plain array
+	static constexpr int64_t slotBatch = 256;
+
+	/// `fix_up_pointers` for slot mode. Slots are handed out in order as a side grows (and again by
+	/// `renumber()`), so a range is mostly made of runs of consecutive slots, ascending on the right
+	/// side and descending on the left. Each run's positions get one contiguous `add_to_each`, only
+	/// the odd reused slot between them is shifted on its own.
+	void shift_slot_positions(int64_t first, int64_t last, int64_t amount)
 	{
-		if constexpr (options == InsertInnerOptions::ForceLeft)
+		SlotTable &table = nodeData.slotTable;
+		int64_t *positions = table.positions.data();
+		// The end node's slot is never in order with the rest
+		if (last == (int64_t)nodeData.data.size() && first < last)
 		{
-			insert_left(iter, value);
+			positions[endNode.pos] += amount;
+			last--;
 		}
-		else if constexpr (options == InsertInnerOptions::ForceRight)
+
+		// The run being collected, which may go on in the next batch
+		int64_t runFirst = 0;
+		int64_t runLength = 0;
+		int64_t step = 1;
+		auto shiftRun = [&] {
+			if (runLength >= minSlotRun)
+			{
+				add_to_each(positions + (step > 0 ? runFirst : runFirst - runLength + 1), runLength, amount);
+				return;
+			}
+			for (int64_t i = 0; i < runLength; i++)
+				positions[runFirst + i * step] += amount;
+			table.scattered += runLength;
+		};
+
+		Slot batch[slotBatch];
+		auto iter = table.slots.begin() + first;
+		for (int64_t left = last - first; left > 0;)
 		{
-			insert_right(iter, value);
+			int64_t count = std::min(left, slotBatch);
+			std::copy_n(iter, count, batch);
+			iter += count;
+			left -= count;
+			for (int64_t i = 0; i < count;)
+			{
+				if (runLength == 1)
+					step = (int64_t)batch[i] == runFirst - 1 ? -1 : 1;
+				int64_t grown = runLength > 0 ? run_length(batch + i, count - i, runFirst + runLength * step, step) : 0;
+				runLength += grown;
+				i += grown;
+				if (i == count)
+					break;
+				shiftRun();
+				runFirst = batch[i++];
+				runLength = 1;
+			}
 		}
-		else
-		{
-			// Choose the side in this order:
-			// 1. If iter is `pos == 0 && middle == -1`, use left side.
-			//    This ensures that the LHS always has at-least 1 element (so that when we use
-			//    `insert(begin(), ...)` we add to the LHS).
-			// 2. If iter is not `pos == 0` (border between left/right), use the same side of `iter.isLeft`
+		shiftRun();
+	}
 
-			if (iter.node->pos == 0 && nodeData.middle == -1) [[unlikely]]
+	/// Renumbers once shifting scattered slots has cost about as much as `renumber()` itself, so
+	/// later shifts see long runs again. Only called where the node table is consistent.
+	void compact_slots()
+	{
+		if constexpr (slotPositions)
+			if (nodeData.slotTable.scattered > (int64_t)nodeData.data.size())
+				renumber();
+	}
+
+	/// Sets the position of a node that is about to be linked in (and gives it a slot in slot mode)
+	void assign_position(NodeBase *node, int64_t position)
+	{
+		if constexpr (slotPositions)
+		{
+			SlotTable &table = nodeData.slotTable;
+			if (table.freeSlots.empty())
 			{
-				insert_left(iter, value);
+				node->pos = table.positions.size();
+				table.positions.push_back(position);
 			}
 			else
 			{
-				if (iter.isLeft)
-					insert_left(iter, value);
-				else
-					insert_right(iter, value);
+				node->pos = table.freeSlots.back();
+				table.freeSlots.pop_back();
+				table.positions[node->pos] = position;
 			}
 		}
+		else
+		{
+			node->pos = position;
+		}
 	}
 
-public:
-	stable_deque()
+	/// Inserts `newNodes` at `index` of `stable_deque_data::data` (and their slots into `SlotTable::slots`)
+	void link_nodes(int64_t index, NodeBase *const *newNodes, int64_t count)
 	{
-		nodeAllocator = NodeAllocator();
-		shared_init();
-	}
+		if (count == 1)
+			nodeData.data.insert(nodeData.data.begin() + index, newNodes[0]);
+		else
+			nodeData.data.insert(nodeData.data.begin() + index, newNodes, newNodes + count);
+		ranks_inserted(index, count);
 
-	~stable_deque()
-	{
-		for (auto *node : nodeData.data)
+		if constexpr (slotPositions)
 		{
-			NodeAllocatorTraits::destroy(nodeAllocator, node);
-			NodeAllocatorTraits::deallocate(nodeAllocator, node, 1);
+			auto &slots = nodeData.slotTable.slots;
+			slots.insert(slots.begin() + index, count, Slot{});
+			for (int64_t i = 0; i < count; i++)
+				slots[index + i] = (Slot)newNodes[i]->pos;
 		}
 	}
 
-	iterator begin()
+	/// Keeps `stable_deque_data::ranks` up to date after `count` nodes were linked in at `index`
+	void ranks_inserted(int64_t index, int64_t count)
 	{
-		return iterator(nodeData, nodeData.middle != -1, nodeData.data.front());
+		if constexpr (tombstones)
+			nodeData.ranks.inserted(index, count, nodeData.data.size(), nodeData.deadCount, live_at());
 	}
 
-	iterator end()
+	/// Same after `count` nodes at `index` were taken out of `stable_deque_data::data`
+	void ranks_removed(int64_t index, int64_t count)
 	{
-		return iterator(nodeData, false, nodeData.data.back());
+		if constexpr (tombstones)
+			nodeData.ranks.removed(index, count, nodeData.data.size(), nodeData.deadCount, live_at());
 	}
 
-	std::size_t size()
+	/// What `tombstone_ranks` rebuilds from
+	auto live_at() const
 	{
-		// -1 for end() node
-		return nodeData.data.size() - 1;
+		return [this](int64_t index) { return !stable_deque_data::is_dead(nodeData.data[index]); };
 	}
 
-	void push_back(const T &value)
+	void shared_init()
 	{
-		// Add to 'right' of the 'middle' of our deque
-		insert_inner<InsertInnerOptions::ForceRight>(end(), value);
+		// Add end node
+		assign_position(&endNode, 0);
+		if constexpr (blockedPositions)
+			endNode.block = new_block(0, 0, 1);
+		NodeBase *endPointer = &endNode;
+		link_nodes(0, &endPointer, 1);
 	}
 
-	void push_front(const T &value)
+	// Block mode (`Options::position_block_size`) helpers.
+	// Side positions count away from `middle`, 0 being the node right next to it on either side.
+	// Every block covers a contiguous run of positions of one side, so a whole run of blocks is
+	// shifted by touching one node and one block per block instead of every node.
+
+	Block *new_block(int64_t base, int64_t begin, int64_t end)
 	{
-		// Add to 'left' of the 'middle' of our deque
-		insert_inner<InsertInnerOptions::ForceLeft>(begin(), value);
+		Block *block = blockPool.allocate(blockAllocator);
+		BlockAllocatorTraits::construct(blockAllocator, block, Block{base, begin, end});
+		return block;
+	}
+
+	static int64_t block_size(const Block *block)
+	{
+		return block->end - block->begin;
+	}
+
+	int64_t side_size(bool isLeft) const
+	{
+		return isLeft ? nodeData.middle + 1 : (int64_t)nodeData.data.size() - nodeData.middle - 1;
+	}
+
+	int64_t &side_bias(bool isLeft)
+	{
+		return isLeft ? nodeData.leftBias : nodeData.rightBias;
+	}
+
+	/// Indices of `stable_deque_data::data` holding the side positions [first, last)
+	std::pair<int64_t, int64_t> side_indices(bool isLeft, int64_t first, int64_t last) const
+	{
+		if (isLeft)
+			return {nodeData.middle + 1 - last, nodeData.middle + 1 - first};
+		else
+			return {nodeData.middle + 1 + first, nodeData.middle + 1 + last};
+	}
+
+	NodeBase *node_at(bool isLeft, int64_t position)
+	{
+		return nodeData.data[side_indices(isLeft, position, position + 1).first];
+	}
+
+	/// Side position of the innermost node of `block`
+	int64_t block_start(bool isLeft, const Block *block)
+	{
+		return block->base + block->begin + side_bias(isLeft);
 	}
 
-	void insert(iterator iterator, const T &value)
+	/// Shifts `pos` of the nodes in the side positions [first, last)
+	void fix_up_side(bool isLeft, int64_t first, int64_t last, int64_t amount)
 	{
-		insert_inner<InsertInnerOptions::None>(iterator, value);
+		auto [firstIndex, lastIndex] = side_indices(isLeft, first, last);
+		fix_up_pointers(firstIndex, lastIndex, amount);
 	}
 
-	void erase(iterator iterator)
+	/// Shifts every block in the side positions [first, last), which must start and end on block borders
+	void shift_blocks(bool isLeft, int64_t first, int64_t last, int64_t amount)
 	{
-		typename decltype(stable_deque_data::data)::iterator underlyingNode;
-		if (iterator.isLeft)
+		while (first < last)
 		{
-			nodeData.middle -= 1;
-			// Since we subtract one for every iterator, we need to iterate two every loop
-			fix_up_pointers<2, -1>(iterator, begin());
-			underlyingNode = iterator.get_underlying_data_iterator();
+			Block *block = node_at(isLeft, first)->block;
+			block->base += amount;
+			first += block_size(block);
+		}
+	}
+
+	/// Moves the nodes in the side positions [first, last) into `block`, shifting their `pos` by `amount`
+	void move_to_block(bool isLeft, int64_t first, int64_t last, Block *block, int64_t amount)
+	{
+		auto [firstIndex, lastIndex] = side_indices(isLeft, first, last);
+		if constexpr (collectStats)
+			nodeData.stats->record_fix_up(lastIndex - firstIndex);
+		auto end = nodeData.data.begin() + lastIndex;
+		for (auto iter = nodeData.data.begin() + firstIndex; iter != end; ++iter)
+		{
+			(*iter)->block = block;
+			(*iter)->pos += amount;
+		}
+	}
+
+	/// Block mode version of the fix-ups in `insert_left`/`insert_right`: every node at a side position
+	/// >= `position` moves `count` further away from `middle`. Returns the block the new nodes go into.
+	Block *make_room_in_blocks(bool isLeft, int64_t position, int64_t count)
+	{
+		int64_t sideSize = side_size(isLeft);
+		if (sideSize == 0)
+			return new_block(-side_bias(isLeft), 0, count);
+
+		Block *host = node_at(isLeft, position < sideSize ? position : position - 1)->block;
+		int64_t hostStart = block_start(isLeft, host);
+		int64_t hostEnd = hostStart + block_size(host);
+
+		// Inside the host block, renumber whichever part is shorter
+		if (position - hostStart <= hostEnd - position)
+		{
+			fix_up_side(isLeft, hostStart, position, -count);
+			host->base += count;
+			host->begin -= count;
+		}
+		else
+		{
+			fix_up_side(isLeft, position, hostEnd, count);
+			host->end += count;
+		}
+
+		// The blocks further out move with it, either directly or through the side bias
+		if (sideSize - hostEnd <= hostStart)
+		{
+			shift_blocks(isLeft, hostEnd, sideSize, count);
 		}
 		else
 		{
-			underlyingNode = iterator.get_underlying_data_iterator();
-			fix_up_pointers<2, -1>(iterator, end());
+			side_bias(isLeft) += count;
+			host->base -= count;
+			shift_blocks(isLeft, 0, hostStart, -count);
 		}
-		Node *node = iterator.node;
-		nodeData.data.erase(underlyingNode);
-		NodeAllocatorTraits::destroy(nodeAllocator, node);
-		NodeAllocatorTraits::deallocate(nodeAllocator, node, 1);
+		return host;
 	}
-	T &operator[](int64_t index)
+
+	/// Hands the new nodes (in `stable_deque_data::data` order) at the side positions
+	/// [position, position + count) over to `block`, then splits it if it grew too big
+	void place_in_block(bool isLeft, Block *block, int64_t position, NodeBase *const *newNodes, int64_t count)
+	{
+		int64_t offset = position - block->base - side_bias(isLeft);
+		for (int64_t i = 0; i < count; i++)
+		{
+			newNodes[i]->block = block;
+			newNodes[i]->pos = offset + (isLeft ? count - 1 - i : i);
+		}
+
+		// Peel the outermost nodes off into new blocks, so blocks stay within twice the block size
+		while (block_size(block) > 2 * blockSize)
+		{
+			Block *outer = new_block(block->base, block->end - blockSize, block->end);
+			block->end = outer->begin;
+			int64_t outerStart = block_start(isLeft, outer);
+			move_to_block(isLeft, outerStart, outerStart + blockSize, outer, 0);
+		}
+	}
+
+	/// Block mode version of the fix-ups in `erase_inner`: unlinks the side positions [first, last)
+	/// from their blocks and moves every node further out closer to `middle`
+	void erase_from_blocks(bool isLeft, int64_t first, int64_t last)
 	{
-		assert(index >= 0 && index < end().node->pos + nodeData.middle + 1);
-		return *(begin() + index);
+		int64_t count = last - first;
+		int64_t sideSize = side_size(isLeft);
+		Block *inner = node_at(isLeft, first)->block;
+		Block *outer = node_at(isLeft, last - 1)->block;
+		int64_t innerStart = block_start(isLeft, inner);
+		int64_t innerEnd = innerStart + block_size(inner);
+		int64_t outerStart = block_start(isLeft, outer);
+		int64_t outerEnd = outerStart + block_size(outer);
+
+		// Blocks fully inside the range
+		for (int64_t position = innerEnd; position < outerStart;)
+		{
+			Block *block = node_at(isLeft, position)->block;
+			position += block_size(block);
+			blockPool.deallocate(block);
+		}
+
+		// What is left of `staying` keeps its position, what is left of `moving` moves with the rest of the side
+		Block *staying = nullptr;
+		Block *moving = nullptr;
+		if (inner == outer)
+		{
+			if (first == innerStart && last == outerEnd)
+			{
+				blockPool.deallocate(inner);
+			}
+			else if (outerEnd - last <= first - innerStart)
+			{
+				fix_up_side(isLeft, last, outerEnd, -count);
+				inner->end -= count;
+				staying = inner;
+			}
+			else
+			{
+				fix_up_side(isLeft, innerStart, first, count);
+				inner->begin += count;
+				moving = inner;
+			}
+		}
+		else
+		{
+			if (first == innerStart)
+			{
+				blockPool.deallocate(inner);
+			}
+			else
+			{
+				inner->end -= innerEnd - first;
+				staying = inner;
+			}
+			if (last == outerEnd)
+			{
+				blockPool.deallocate(outer);
+			}
+			else
+			{
+				outer->begin += last - outerStart;
+				moving = outer;
+			}
+		}
+
+		if (sideSize - last <= first)
+		{
+			if (moving != nullptr)
+				moving->base -= count;
+			shift_blocks(isLeft, outerEnd, sideSize, -count);
+		}
+		else
+		{
+			side_bias(isLeft) -= count;
+			if (staying != nullptr)
+				staying->base += count;
+			shift_blocks(isLeft, 0, innerStart, count);
+		}
 	}
-};
\ No newline at end of file
+
+	/// Folds the block holding `position` into its smaller neighbour once erases left it nearly empty,
+	/// so a side never ends up with many more blocks than it has nodes / `Options::position_block_size`
+	void merge_small_block(bool isLeft, int64_t position)
+	{
+		int64_t sideSize = side_size(isLeft);
+		if (position < 0 || position >= sideSize)
+			return;
+		Block *block = node_at(isLeft, position)->block;
+		int64_t size = block_size(block);
+		if (size * 4 >= blockSize)
+			return;
+
+		int64_t start = block_start(isLeft, block);
+		Block *innerNeighbour = start > 0 ? node_at(isLeft, start - 1)->block : nullptr;
+		Block *outerNeighbour = start + size < sideSize ? node_at(isLeft, start + size)->block : nullptr;
+		Block *into = innerNeighbour;
+		if (into == nullptr || (outerNeighbour != nullptr && block_size(outerNeighbour) < block_size(into)))
+			into = outerNeighbour;
+		if (into == nullptr || block_size(into) + size > blockSize)
+			return;
+
+		move_to_block(isLeft, start, start + size, into, block->base - into->base);
+		if (into == innerNeighbour)
+			into->end += size;
+		else
+			into->begin -= size;
+		blockPool.deallocate(block);
+	}
+
+	enum class InsertInnerOptions
+	{
+		None,
+		ForceLeft,
+		ForceRight
+	};
+
+	// Every insert/erase shifts the positions of one side on either side of the touched node.
+	// One of the two runs is shifted by walking its nodes, the other (the rest of the side) by
+	// adjusting the side's bias, so we always pick whichever run is shorter.
+
+	// Nodes are created by the caller before any position is touched, so a throwing `T`
+	// constructor leaves the deque unchanged. Inserting `count` nodes at once only costs a
+	// single renumbering pass and a single insert into `stable_deque_data::data`.
+
+	// Insert on the left side of the deque
+	iterator insert_left(const iterator &iter, NodeBase *const *newNodes, int64_t count)
+	{
+		// `iter` may be the first node of the right side when inserting at the border
+		int64_t index = iter.get_underlying_index();
+		if constexpr (blockedPositions)
+		{
+			int64_t position = nodeData.middle + 1 - index;
+			Block *block = make_room_in_blocks(true, position, count);
+			nodeData.middle += count;
+			nodeData.data.insert(nodeData.data.begin() + index, newNodes, newNodes + count);
+			ranks_inserted(index, count);
+			place_in_block(true, block, position, newNodes, count);
+			return iterator(&nodeData, true, newNodes[0]);
+		}
+
+		// Nodes in [0, index) move further away from `middle`, [index, middle] keep their position
+		if (index <= nodeData.middle + 1 - index)
+		{
+			fix_up_pointers(0, index, count);
+		}
+		else
+		{
+			nodeData.leftBias += count;
+			fix_up_pointers(index, nodeData.middle + 1, -count);
+		}
+		nodeData.middle += count;
+
+		for (int64_t i = 0; i < count; i++)
+			assign_position(newNodes[i], nodeData.middle - index - i - nodeData.leftBias);
+		link_nodes(index, newNodes, count);
+		compact_slots();
+		return iterator(&nodeData, true, newNodes[0]);
+	}
+
+	// Insert on the right side of the deque
+	iterator insert_right(const iterator &iter, NodeBase *const *newNodes, int64_t count)
+	{
+		int64_t index = iter.get_underlying_index();
+		int64_t position = iter.pos();
+		if constexpr (blockedPositions)
+		{
+			Block *block = make_room_in_blocks(false, position, count);
+			nodeData.data.insert(nodeData.data.begin() + index, newNodes, newNodes + count);
+			ranks_inserted(index, count);
+			place_in_block(false, block, position, newNodes, count);
+			return iterator(&nodeData, false, newNodes[0]);
+		}
+
+		// Nodes in [index, end()] move further away from `middle`, (middle, index) keep their position
+		if ((int64_t)nodeData.data.size() - index <= position)
+		{
+			fix_up_pointers(index, nodeData.data.size(), count);
+		}
+		else
+		{
+			nodeData.rightBias += count;
+			fix_up_pointers(nodeData.middle + 1, index, -count);
+		}
+
+		for (int64_t i = 0; i < count; i++)
+			assign_position(newNodes[i], position + i - nodeData.rightBias);
+		link_nodes(index, newNodes, count);
+		compact_slots();
+		return iterator(&nodeData, false, newNodes[0]);
+	}
+
+	template <InsertInnerOptions options>
+	iterator insert_inner(const iterator &iter, NodeBase *const *newNodes, int64_t count)
+	{
+		if constexpr (options == InsertInnerOptions::ForceLeft)
+		{
+			return insert_left(iter, newNodes, count);
+		}
+		else if constexpr (options == InsertInnerOptions::ForceRight)
+		{
+			return insert_right(iter, newNodes, count);
+		}
+		else
+		{
+			// Choose the side in this order:
+			// 1. If iter is `pos == 0 && middle == -1`, use left side.
+			//    This ensures that the LHS always has at-least 1 element (so that when we use
+			//    `insert(begin(), ...)` we add to the LHS).
+			// 2. If iter is not `pos == 0` (border between left/right), use the same side of `iter.isLeft`
+
+			if (iter.pos() == 0 && nodeData.middle == -1) [[unlikely]]
+			{
+				return insert_left(iter, newNodes, count);
+			}
+			else
+			{
+				if (iter.isLeft)
+					return insert_left(iter, newNodes, count);
+				else
+					return insert_right(iter, newNodes, count);
+			}
+		}
+	}
+
+	using NodeBuffer = std::vector<NodeBase *, NodePAllocator>;
+
+	/// `createNodes` fills a buffer with new nodes, which are then spliced in before `iter` in one go
+	template <InsertInnerOptions options, typename CreateNodes>
+	iterator insert_nodes(const iterator &iter, CreateNodes createNodes)
+	{
+		NodeBuffer newNodes{NodePAllocator(nodeAllocator)};
+		try
+		{
+			createNodes(newNodes);
+		}
+		catch (...)
+		{
+			for (auto *node : newNodes)
+				destroy_node(static_cast<Node *>(node));
+			throw;
+		}
+
+		if (newNodes.empty())
+			return iter;
+		return insert_inner<options>(iter, newNodes.data(), newNodes.size());
+	}
+
+	template <InsertInnerOptions options, typename InputIt>
+	iterator insert_range_inner(const iterator &iter, InputIt first, InputIt last)
+	{
+		return insert_nodes<options>(iter, [&](NodeBuffer &newNodes) {
+			if constexpr (std::forward_iterator<InputIt>)
+				newNodes.reserve(std::ranges::distance(first, last));
+			for (; first != last; ++first)
+				newNodes.push_back(create_node<NodePlacement::Forward>(*first));
+		});
+	}
+
+	iterator iterator_at(int64_t index)
+	{
+		return iterator(&nodeData, index <= nodeData.middle, nodeData.data[index]);
+	}
+
+	// Erases the nodes stored in [first, last) of `stable_deque_data::data`.
+	// The range may span both sides; each side's part is renumbered like a single erase, so
+	// the whole range costs one fix-up pass and one erase from the underlying deque.
+	iterator erase_inner(int64_t first, int64_t last)
+	{
+		remove_nodes(first, last);
+		if constexpr (tombstones)
+			return after_tombstones(first);
+		else
+			return iterator_at(first);
+	}
+
+	void remove_nodes(int64_t first, int64_t last)
+	{
+		int64_t leftLast = std::min(last, nodeData.middle + 1);
+		int64_t rightFirst = std::max(first, nodeData.middle + 1);
+		int64_t leftCount = std::max<int64_t>(leftLast - first, 0);
+		int64_t rightCount = std::max<int64_t>(last - rightFirst, 0);
+
+		if constexpr (blockedPositions)
+		{
+			// Both parts in side positions, taken before `middle` moves
+			if (leftCount > 0)
+				erase_from_blocks(true, nodeData.middle + 1 - leftLast, nodeData.middle + 1 - first);
+			if (rightCount > 0)
+				erase_from_blocks(false, rightFirst - nodeData.middle - 1, last - nodeData.middle - 1);
+			nodeData.middle -= leftCount;
+		}
+		else
+		{
+			if (leftCount > 0)
+			{
+				// Nodes in [0, first) move closer to `middle`, [leftLast, middle] keep their position.
+				// Erasing next to `middle` (what `erase(end() - 1)` hits once the right side runs out)
+				// is therefore only a bias update.
+				if (first <= nodeData.middle + 1 - leftLast)
+				{
+					fix_up_pointers(0, first, -leftCount);
+				}
+				else
+				{
+					nodeData.leftBias -= leftCount;
+					fix_up_pointers(leftLast, nodeData.middle + 1, leftCount);
+				}
+				nodeData.middle -= leftCount;
+			}
+			if (rightCount > 0)
+			{
+				// Nodes in [last, end()] move closer to `middle`, (middle, rightFirst) keep their position.
+				// Same as above, `erase(begin())` once the left side runs out is only a bias update.
+				if ((int64_t)nodeData.data.size() - last <= rightFirst - (nodeData.middle + leftCount) - 1)
+				{
+					fix_up_pointers(last, nodeData.data.size(), -rightCount);
+				}
+				else
+				{
+					nodeData.rightBias -= rightCount;
+					fix_up_pointers(nodeData.middle + leftCount + 1, rightFirst, rightCount);
+				}
+			}
+		}
+
+		if constexpr (slotPositions)
+		{
+			SlotTable &table = nodeData.slotTable;
+			auto slotsFirst = table.slots.begin() + first;
+			auto slotsLast = table.slots.begin() + last;
+			table.freeSlots.insert(table.freeSlots.end(), slotsFirst, slotsLast);
+			table.slots.erase(slotsFirst, slotsLast);
+		}
+
+		auto underlyingFirst = nodeData.data.begin() + first;
+		auto underlyingLast = nodeData.data.begin() + last;
+		for (auto iter = underlyingFirst; iter != underlyingLast; ++iter)
+			destroy_node(static_cast<Node *>(*iter));
+		if (last - first == 1)
+			nodeData.data.erase(underlyingFirst);
+		else
+			nodeData.data.erase(underlyingFirst, underlyingLast);
+		ranks_removed(first, last - first);
+		compact_slots();
+
+		if constexpr (blockedPositions)
+		{
+			// The blocks on both sides of each gap may be nearly empty now
+			if (leftCount > 0)
+			{
+				merge_small_block(true, nodeData.middle - first);
+				merge_small_block(true, nodeData.middle + 1 - first);
+			}
+			if (rightCount > 0)
+			{
+				int64_t gap = rightFirst - leftCount - nodeData.middle - 1;
+				merge_small_block(false, gap - 1);
+				merge_small_block(false, gap);
+			}
+		}
+	}
+
+	/// Removes the tombstones that reached either end, so the first and last node are always live
+	void trim_tombstones()
+	{
+		auto &data = nodeData.data;
+		int64_t leading = 0;
+		while (leading < (int64_t)data.size() - 1 && stable_deque_data::is_dead(data[leading]))
+			leading++;
+		if (leading > 0)
+			remove_nodes(0, leading);
+
+		int64_t last = data.size() - 1;
+		int64_t first = last;
+		while (first > 0 && stable_deque_data::is_dead(data[first - 1]))
+			first--;
+		if (first < last)
+			remove_nodes(first, last);
+	}
+
+	/// Trims the ends and returns an iterator to the first live node stored at or after `index`
+	iterator after_tombstones(int64_t index)
+	{
+		while (stable_deque_data::is_dead(nodeData.data[index]))
+			index++;
+		// Trimming keeps every remaining node on its side
+		iterator next = iterator_at(index);
+		trim_tombstones();
+		return next;
+	}
+
+	/// Destroys the element at `index` but leaves its node in place, `index` isn't at either end
+	iterator bury(int64_t index)
+	{
+		// Every other node is live when the first tombstone appears
+		if (nodeData.ranks.empty())
+			nodeData.ranks.build_live(nodeData.data.size());
+		// Counted from `index` while it is still live
+		iterator next = iterator_at(nodeData.live_index(index, 1));
+
+		Node *node = static_cast<Node *>(nodeData.data[index]);
+		std::destroy_at(&node->data);
+		nodeData.ranks.bury(index);
+		node->dead = true;
+		nodeData.deadCount++;
+		if (nodeData.deadCount * 100 > (int64_t)(nodeData.data.size() - 1) * (int64_t)Options::tombstone_compact_percent)
+			compact();
+		return next;
+	}
+
+	// Traversal helpers for `for_each`/`for_each_segment`. `Nodes` is `stable_deque_data::data`
+	// (const or not), `Value` is `T` or `const T`.
+
+	template <typename Value>
+	static auto make_segment(NodeBase *const *first, NodeBase *const *last)
+	{
+		return std::span<NodeBase *const>(first, last) |
+			   std::views::transform([](NodeBase *node) -> Value & { return static_cast<Node *>(node)->data; });
+	}
+
+	template <typename Value, typename Nodes, typename Function>
+	static void walk_nodes(Nodes &nodes, Function &function)
+	{
+		// Skip the end node
+		auto end = nodes.end() - 1;
+		auto iter = nodes.begin();
+		auto ahead = iter + std::min<std::ptrdiff_t>(Options::prefetch_distance, end - iter);
+		for (; iter != end; ++iter)
+		{
+			if constexpr (Options::prefetch_distance > 0)
+			{
+				if (ahead != end)
+				{
+					prefetch_for_read(*ahead);
+					++ahead;
+				}
+			}
+			if (stable_deque_data::is_dead(*iter))
+				continue;
+			function(static_cast<Value &>(static_cast<Node *>(*iter)->data));
+		}
+	}
+
+	template <typename Value, typename Nodes, typename Function>
+	static void walk_segments(Nodes &nodes, Function &function)
+	{
+		auto end = nodes.end() - 1;
+		auto iter = nodes.begin();
+		// Splits off the run of node pointers that `std::deque` stores next to each other.
+		// Tombstones end a run and are skipped (the first node is never one).
+		auto nextRun = [&]() {
+			NodeBase *const *first = &*iter;
+			NodeBase *const *last = first;
+			while (iter != end && &*iter == last && !stable_deque_data::is_dead(*iter))
+			{
+				++iter;
+				++last;
+			}
+			while (iter != end && stable_deque_data::is_dead(*iter))
+				++iter;
+			return std::pair{first, last};
+		};
+
+		if (iter == end)
+			return;
+		auto run = nextRun();
+		while (true)
+		{
+			bool isLast = iter == end;
+			auto next = run;
+			if (!isLast)
+			{
+				// Get the next segment's nodes on their way while `function` works on this one
+				next = nextRun();
+				if constexpr (Options::prefetch_distance > 0)
+				{
+					for (auto node = next.first; node != next.second; ++node)
+						prefetch_for_read(*node);
+				}
+			}
+			function(make_segment<Value>(run.first, run.second));
+			if (isLast)
+				return;
+			run = next;
+		}
+	}
+
+	/// Recomputes every position from scratch (and drops the side biases)
+	void renumber()
+	{
+		nodeData.leftBias = 0;
+		nodeData.rightBias = 0;
+		if constexpr (blockedPositions)
+		{
+			// Start over with full blocks
+			blockPool.release(blockAllocator);
+			for (bool isLeft : {true, false})
+			{
+				int64_t sideSize = side_size(isLeft);
+				for (int64_t first = 0; first < sideSize; first += blockSize)
+				{
+					int64_t last = std::min(first + blockSize, sideSize);
+					Block *block = new_block(first, 0, last - first);
+					for (int64_t position = first; position < last; position++)
+					{
+						NodeBase *node = node_at(isLeft, position);
+						node->block = block;
+						node->pos = position - first;
+					}
+				}
+			}
+			return;
+		}
+
+		if constexpr (slotPositions)
+		{
+			// Hand out slots in `stable_deque_data::data` order again, so every range of slots is contiguous
+			SlotTable &table = nodeData.slotTable;
+			table.freeSlots.clear();
+			table.scattered = 0;
+			table.positions.resize(nodeData.data.size());
+			table.slots.resize(nodeData.data.size());
+		}
+
+		int64_t index = 0;
+		for (auto *node : nodeData.data)
+		{
+			int64_t position = index <= nodeData.middle ? nodeData.middle - index : index - nodeData.middle - 1;
+			if constexpr (slotPositions)
+			{
+				node->pos = index;
+				nodeData.slotTable.slots[index] = (Slot)index;
+				nodeData.slotTable.positions[index] = position;
+			}
+			else
+			{
+				node->pos = position;
+			}
+			index++;
+		}
+	}
+
+	/// Fills an empty container with the elements of `other`, split at the same place. Copies them
+	/// out of a `const` container and moves them out of any other (which keeps its nodes).
+	/// The nodes come out of one pool reservation and the node table is sized once and filled in
+	/// place, positions included, instead of growing by one `push_back()` per element.
+	template <typename Source>
+	void copy_from(Source &other)
+	{
+		int64_t count = other.size();
+		int64_t left = other.left_size();
+		reserve(count);
+
+		auto &data = nodeData.data;
+		data.assign(count + 1, nullptr);
+		data.back() = &endNode;
+		auto write = data.begin();
+		int64_t index = 0;
+		try
+		{
+			other.for_each([&](auto &element) {
+				Node *node;
+				if constexpr (std::is_const_v<Source>)
+					node = create_node<NodePlacement::Forward>(element);
+				else
+					node = create_node<NodePlacement::Forward>(std::move(element));
+				node->pos = index < left ? left - 1 - index : index - left;
+				*write++ = node;
+				index++;
+			});
+		}
+		catch (...)
+		{
+			// Keep what made it in
+			data.erase(write, data.end() - 1);
+			nodeData.middle = std::min(index, left) - 1;
+			renumber();
+			throw;
+		}
+
+		nodeData.middle = left - 1;
+		if (blockedPositions || slotPositions)
+			renumber();
+		else
+			endNode.pos = count - left;
+	}
+
+	/// Swaps two of the standard containers inside, element by element when their allocators
+	/// can't free each other's memory
+	template <typename Container>
+	static void exchange(Container &left, Container &right)
+	{
+		if (left.get_allocator() == right.get_allocator())
+		{
+			left.swap(right);
+			return;
+		}
+		Container held(std::move(left));
+		left = std::move(right);
+		right = std::move(held);
+	}
+
+	/// Everything `swap()` exchanges. The allocators only change hands with `withAllocators`,
+	/// otherwise they must compare equal.
+	template <bool withAllocators>
+	void swap_storage(stable_deque &other)
+	{
+		using std::swap;
+		if constexpr (withAllocators)
+		{
+			swap(nodeAllocator, other.nodeAllocator);
+			if constexpr (blockedPositions)
+				swap(blockAllocator, other.blockAllocator);
+		}
+		nodePool.swap(other.nodePool);
+		if constexpr (blockedPositions)
+			blockPool.swap(other.blockPool);
+		swap(nodeData.middle, other.nodeData.middle);
+		swap(nodeData.leftBias, other.nodeData.leftBias);
+		swap(nodeData.rightBias, other.nodeData.rightBias);
+		exchange(nodeData.data, other.nodeData.data);
+		if constexpr (slotPositions)
+		{
+			exchange(nodeData.slotTable.positions, other.nodeData.slotTable.positions);
+			exchange(nodeData.slotTable.slots, other.nodeData.slotTable.slots);
+			exchange(nodeData.slotTable.freeSlots, other.nodeData.slotTable.freeSlots);
+			swap(nodeData.slotTable.scattered, other.nodeData.slotTable.scattered);
+		}
+		if constexpr (tombstones)
+		{
+			swap(nodeData.deadCount, other.nodeData.deadCount);
+			nodeData.ranks.swap(other.nodeData.ranks);
+		}
+
+		// The end nodes are part of the containers, so only their state changes hands
+		swap(endNode, other.endNode);
+		nodeData.data.back() = &endNode;
+		other.nodeData.data.back() = &other.endNode;
+	}
+
+public:
+	stable_deque() : stable_deque(Allocator())
+	{
+	}
+
+	/// Takes the nodes, the node table and the position blocks or slot table from `allocator`
+	/// (rebound to each)
+	explicit stable_deque(const Allocator &allocator) :
+		nodeAllocator(allocator), blockAllocator(allocator), nodeData(allocator)
+	{
+		shared_init();
+	}
+
+	/// Copies the elements (and where `middle` splits them), not the tombstones, the stats or
+	/// the spare pool capacity of `other`. The allocator comes from
+	/// `select_on_container_copy_construction()`, like for the standard containers.
+	stable_deque(const stable_deque &other) :
+		stable_deque(other, AllocatorTraits::select_on_container_copy_construction(other.get_allocator()))
+	{
+	}
+
+	stable_deque(const stable_deque &other, const std::type_identity_t<Allocator> &allocator) : stable_deque(allocator)
+	{
+		copy_from(other);
+	}
+
+	/// Takes the nodes of `other` without touching them, which leaves `other` empty. Like for
+	/// `swap()`, references stay valid and iterators don't.
+	stable_deque(stable_deque &&other) : stable_deque(other.get_allocator())
+	{
+		swap_storage<false>(other);
+	}
+
+	/// Like the move constructor if `allocator` equals the one of `other`. Otherwise the elements
+	/// are moved one by one into nodes from `allocator` and `other` keeps its (moved from) nodes.
+	stable_deque(stable_deque &&other, const std::type_identity_t<Allocator> &allocator) : stable_deque(allocator)
+	{
+		if (get_allocator() == other.get_allocator())
+			swap_storage<false>(other);
+		else
+			copy_from(other);
+	}
+
+	/// Takes the allocator of `other` along if `propagate_on_container_copy_assignment` says so
+	stable_deque &operator=(const stable_deque &other)
+	{
+		if (this != &other)
+		{
+			constexpr bool propagate = AllocatorTraits::propagate_on_container_copy_assignment::value;
+			stable_deque copy(other, propagate ? other.get_allocator() : get_allocator());
+			swap_storage<propagate>(copy);
+		}
+		return *this;
+	}
+
+	/// O(1) if `propagate_on_container_move_assignment` is set or the allocators are equal,
+	/// otherwise moves the elements one by one like the allocator extended move constructor
+	stable_deque &operator=(stable_deque &&other)
+	{
+		if (this != &other)
+		{
+			constexpr bool propagate = AllocatorTraits::propagate_on_container_move_assignment::value;
+			stable_deque moved(std::move(other), propagate ? other.get_allocator() : get_allocator());
+			swap_storage<propagate>(moved);
+		}
+		return *this;
+	}
+
+	/// Exchanges the contents in O(1): the node tables, pools and positions change hands, the
+	/// nodes themselves stay where they are. References and pointers to elements stay valid and
+	/// refer to the element in its new container. Unlike with `std::deque`, iterators (`end()`
+	/// included) point into the container rather than its nodes, so they must be obtained again.
+	/// The stats (`Options::collect_stats`) stay with their container.
+	/// Like for the standard containers, the allocators are only exchanged if
+	/// `propagate_on_container_swap` is set, otherwise they must compare equal.
+	void swap(stable_deque &other) noexcept(!AllocatorTraits::propagate_on_container_swap::value || AllocatorTraits::is_always_equal::value)
+	{
+		constexpr bool propagate = AllocatorTraits::propagate_on_container_swap::value;
+		assert(propagate || get_allocator() == other.get_allocator());
+		swap_storage<propagate>(other);
+	}
+
+	friend void swap(stable_deque &left, stable_deque &right) noexcept(noexcept(left.swap(right)))
+	{
+		left.swap(right);
+	}
+
+	allocator_type get_allocator() const
+	{
+		return allocator_type(nodeAllocator);
+	}
+
+	~stable_deque()
+	{
+		// Skip the end node, it is part of `this`
+		for (auto iter = nodeData.data.begin(); iter != nodeData.data.end() - 1; ++iter)
+		{
+			Node *node = static_cast<Node *>(*iter);
+			if (!stable_deque_data::is_dead(node))
+				NodeAllocatorTraits::destroy(nodeAllocator, node);
+			if constexpr (!Options::pooled_nodes)
+				NodeAllocatorTraits::deallocate(nodeAllocator, node, 1);
+		}
+		// Pooled nodes are freed chunk by chunk
+		nodePool.release(nodeAllocator);
+		if constexpr (blockedPositions)
+			blockPool.release(blockAllocator);
+	}
+
+	iterator begin()
+	{
+		return iterator(&nodeData, nodeData.middle != -1, nodeData.data.front());
+	}
+
+	iterator end()
+	{
+		return iterator(&nodeData, false, nodeData.data.back());
+	}
+
+	const_iterator begin() const
+	{
+		return const_iterator(&nodeData, nodeData.middle != -1, nodeData.data.front());
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(&nodeData, false, nodeData.data.back());
+	}
+
+	const_iterator cbegin() const
+	{
+		return begin();
+	}
+
+	const_iterator cend() const
+	{
+		return end();
+	}
+
+	reverse_iterator rbegin()
+	{
+		return reverse_iterator(end());
+	}
+
+	reverse_iterator rend()
+	{
+		return reverse_iterator(begin());
+	}
+
+	const_reverse_iterator rbegin() const
+	{
+		return const_reverse_iterator(end());
+	}
+
+	const_reverse_iterator rend() const
+	{
+		return const_reverse_iterator(begin());
+	}
+
+	const_reverse_iterator crbegin() const
+	{
+		return rbegin();
+	}
+
+	const_reverse_iterator crend() const
+	{
+		return rend();
+	}
+
+	std::size_t size() const
+	{
+		// -1 for end() node
+		if constexpr (tombstones)
+			return nodeData.data.size() - 1 - nodeData.deadCount;
+		else
+			return nodeData.data.size() - 1;
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+	T &front()
+	{
+		assert(!empty());
+		return static_cast<Node *>(nodeData.data.front())->data;
+	}
+
+	const T &front() const
+	{
+		assert(!empty());
+		return static_cast<const Node *>(nodeData.data.front())->data;
+	}
+
+	/// The last node sits right before the end node
+	T &back()
+	{
+		assert(!empty());
+		return static_cast<Node *>(nodeData.data[nodeData.data.size() - 2])->data;
+	}
+
+	const T &back() const
+	{
+		assert(!empty());
+		return static_cast<const Node *>(nodeData.data[nodeData.data.size() - 2])->data;
+	}
+
+	/// Counters since construction or the last `reset_stats()`, needs `Options::collect_stats`
+	const stable_deque_stats &stats() const requires collectStats
+	{
+		return *nodeData.stats;
+	}
+
+	void reset_stats() requires collectStats
+	{
+		*nodeData.stats = stable_deque_stats{};
+	}
+
+	/// Makes room for `count` elements in total, so growing up to that size allocates no nodes.
+	/// Only pooled nodes can be reserved. The node pointer deque has no reserve, it grows in
+	/// 512 byte blocks and never moves what it holds.
+	void reserve(std::size_t count)
+	{
+		if constexpr (Options::pooled_nodes)
+			nodePool.reserve(nodeAllocator, count);
+		if constexpr (slotPositions)
+			nodeData.slotTable.positions.reserve(count + 1);
+	}
+
+	/// Returns pool chunks that hold no element and trims the node pointer deque (and the slot
+	/// table), elements keep their address
+	void shrink_to_fit()
+	{
+		if constexpr (Options::pooled_nodes)
+			nodePool.shrink(nodeAllocator);
+		if constexpr (blockedPositions)
+			blockPool.shrink(blockAllocator);
+		if constexpr (slotPositions)
+		{
+			// Compacts the slots, so no position is left unused
+			renumber();
+			nodeData.slotTable.positions.shrink_to_fit();
+			nodeData.slotTable.slots.shrink_to_fit();
+			nodeData.slotTable.freeSlots.shrink_to_fit();
+		}
+		nodeData.data.shrink_to_fit();
+	}
+
+	stable_deque_memory_usage memory_usage() const
+	{
+		stable_deque_memory_usage usage;
+		usage.elements = size() * sizeof(T);
+		usage.node_overhead = size() * (sizeof(Node) - sizeof(T));
+		if constexpr (tombstones)
+			usage.tombstones = nodeData.deadCount * sizeof(Node);
+		if constexpr (Options::pooled_nodes)
+		{
+			usage.idle_nodes = nodePool.capacity() * sizeof(Node) - usage.elements - usage.node_overhead - usage.tombstones;
+			usage.pool_overhead = nodePool.allocated_bytes() - nodePool.capacity() * sizeof(Node);
+		}
+		usage.node_table = deque_bytes_estimate<NodeBase *>(nodeData.data.size());
+		if constexpr (blockedPositions)
+		{
+			usage.positions = blockPool.allocated_bytes();
+		}
+		else if constexpr (slotPositions)
+		{
+			const SlotTable &table = nodeData.slotTable;
+			usage.positions = table.positions.capacity() * sizeof(int64_t) + deque_bytes_estimate<Slot>(table.slots.size()) +
+							  table.freeSlots.capacity() * sizeof(Slot);
+		}
+		if constexpr (tombstones)
+			usage.positions += nodeData.ranks.allocated_bytes();
+		return usage;
+	}
+
+	void push_back(const T &value)
+	{
+		emplace_back(value);
+	}
+
+	void push_back(T &&value)
+	{
+		emplace_back(std::move(value));
+	}
+
+	template <typename... Args>
+	T &emplace_back(Args &&...args)
+	{
+		// Add to 'right' of the 'middle' of our deque
+		NodeBase *newNode = create_node<NodePlacement::Forward>(std::forward<Args>(args)...);
+		return *insert_inner<InsertInnerOptions::ForceRight>(end(), &newNode, 1);
+	}
+
+	void push_front(const T &value)
+	{
+		emplace_front(value);
+	}
+
+	void push_front(T &&value)
+	{
+		emplace_front(std::move(value));
+	}
+
+	template <typename... Args>
+	T &emplace_front(Args &&...args)
+	{
+		// Add to 'left' of the 'middle' of our deque
+		NodeBase *newNode = create_node<NodePlacement::Backward>(std::forward<Args>(args)...);
+		return *insert_inner<InsertInnerOptions::ForceLeft>(begin(), &newNode, 1);
+	}
+
+	iterator insert(iterator iterator, const T &value)
+	{
+		return emplace(iterator, value);
+	}
+
+	iterator insert(iterator iterator, T &&value)
+	{
+		return emplace(iterator, std::move(value));
+	}
+
+	/// Inserts copies of `[first, last)` before `iterator`, returns an iterator to the first inserted element
+	template <std::input_iterator InputIt>
+	iterator insert(iterator iterator, InputIt first, InputIt last)
+	{
+		return insert_range_inner<InsertInnerOptions::None>(iterator, first, last);
+	}
+
+	/// Inserts `count` copies of `value` before `iterator`
+	iterator insert(iterator iterator, std::size_t count, const T &value)
+	{
+		auto repeated = std::views::iota(std::size_t(0), count) | std::views::transform([&value](std::size_t) -> const T & { return value; });
+		return insert_range_inner<InsertInnerOptions::None>(iterator, repeated.begin(), repeated.end());
+	}
+
+	template <std::ranges::input_range Range>
+	void append_range(Range &&range)
+	{
+		insert_range_inner<InsertInnerOptions::ForceRight>(end(), std::ranges::begin(range), std::ranges::end(range));
+	}
+
+	template <std::ranges::input_range Range>
+	void prepend_range(Range &&range)
+	{
+		insert_range_inner<InsertInnerOptions::ForceLeft>(begin(), std::ranges::begin(range), std::ranges::end(range));
+	}
+
+	/// Elements left of `middle`, what `assign_packed()` needs to rebuild the same split
+	std::size_t left_size() const
+	{
+		if constexpr (tombstones)
+		{
+			if (nodeData.deadCount > 0)
+				return nodeData.live_count(0, nodeData.middle + 1);
+		}
+		return nodeData.middle + 1;
+	}
+
+	/// Bulk load used by `stable_deque_snapshot.h`: replaces the contents with `count` elements,
+	/// the first `leftCount` of them left of `middle`. `nextBatch()` returns the following elements
+	/// as a `std::span<const T>`, an empty one (or an exception) ends the load early with what made
+	/// it in. Every node comes out of a single pool reservation, and the node table and positions
+	/// are built in the same pass.
+	template <typename NextBatch>
+	void assign_packed(std::size_t count, std::size_t leftCount, NextBatch nextBatch)
+		requires std::is_trivially_copyable_v<T>
+	{
+		clear();
+		reserve(count);
+		leftCount = std::min(leftCount, count);
+
+		auto &data = nodeData.data;
+		data.pop_back();
+		int64_t index = 0;
+		int64_t left = leftCount;
+		try
+		{
+			while (index < (int64_t)count)
+			{
+				std::span<const T> batch = nextBatch();
+				if (batch.empty())
+					break;
+				batch = batch.first(std::min<std::size_t>(batch.size(), count - index));
+				for (const T &element : batch)
+				{
+					Node *node = create_node<NodePlacement::Forward>(element);
+					node->pos = index < left ? left - 1 - index : index - left;
+					try
+					{
+						data.push_back(node);
+					}
+					catch (...)
+					{
+						destroy_node(node);
+						throw;
+					}
+					index++;
+				}
+			}
+		}
+		catch (...)
+		{
+			// Keep what made it in
+			data.push_back(&endNode);
+			nodeData.middle = std::min(index, left) - 1;
+			renumber();
+			throw;
+		}
+
+		data.push_back(&endNode);
+		nodeData.middle = std::min(index, left) - 1;
+		if (blockedPositions || slotPositions || index < left)
+			renumber();
+		else
+			endNode.pos = index - left;
+	}
+
+	/// Constructs the new element in place, right before `iterator`
+	template <typename... Args>
+	iterator emplace(iterator iterator, Args &&...args)
+	{
+		NodeBase *newNode = create_node(std::forward<Args>(args)...);
+		return insert_inner<InsertInnerOptions::None>(iterator, &newNode, 1);
+	}
+
+	/// Returns an iterator to the element that followed the erased one
+	iterator erase(iterator iterator)
+	{
+		int64_t index = iterator.get_underlying_index();
+		if constexpr (tombstones)
+		{
+			if (index != 0 && index != (int64_t)nodeData.data.size() - 2)
+				return bury(index);
+		}
+		return erase_inner(index, index + 1);
+	}
+
+	/// Erases `[first, last)` with a single renumbering pass, returns `last`
+	iterator erase(iterator first, iterator last)
+	{
+		int64_t firstIndex = first.get_underlying_index();
+		int64_t lastIndex = last.get_underlying_index();
+		if (firstIndex == lastIndex)
+			return last;
+		return erase_inner(firstIndex, lastIndex);
+	}
+
+	/// Same as `erase(begin())` without building an iterator. The deque must not be empty.
+	void pop_front()
+	{
+		assert(!empty());
+		if constexpr (blockedPositions || slotPositions)
+		{
+			erase_inner(0, 1);
+		}
+		else
+		{
+			// On the left side the first node is the farthest from `middle`, so nothing else moves.
+			// Once the left side ran out it is the right side's closest, and the bias absorbs the shift.
+			if (nodeData.middle >= 0)
+				nodeData.middle--;
+			else
+				nodeData.rightBias--;
+			Node *node = static_cast<Node *>(nodeData.data.front());
+			nodeData.data.pop_front();
+			destroy_node(node);
+			ranks_removed(0, 1);
+			if constexpr (tombstones)
+			{
+				// Tombstones never stay at either end
+				if (stable_deque_data::is_dead(nodeData.data.front()))
+					trim_tombstones();
+			}
+		}
+	}
+
+	/// Same as `erase(end() - 1)` without building an iterator. The deque must not be empty.
+	void pop_back()
+	{
+		assert(!empty());
+		int64_t last = nodeData.data.size() - 2;
+		if constexpr (blockedPositions || slotPositions)
+		{
+			erase_inner(last, last + 1);
+		}
+		else
+		{
+			// Mirrors `pop_front()`: only the end node moves, or the left side's bias if the right side ran out
+			if (last > nodeData.middle)
+			{
+				endNode.pos--;
+			}
+			else
+			{
+				nodeData.leftBias--;
+				nodeData.middle--;
+			}
+			Node *node = static_cast<Node *>(nodeData.data[last]);
+			nodeData.data.pop_back();
+			nodeData.data.back() = &endNode;
+			destroy_node(node);
+			ranks_removed(last, 1);
+			if constexpr (tombstones)
+			{
+				if (nodeData.data.size() > 1 && stable_deque_data::is_dead(nodeData.data[nodeData.data.size() - 2]))
+					trim_tombstones();
+			}
+		}
+	}
+
+	/// Moves the first element out and removes it, or returns nothing if the deque is empty
+	std::optional<T> try_pop_front()
+	{
+		if (empty())
+			return std::nullopt;
+		std::optional<T> value(std::move(front()));
+		pop_front();
+		return value;
+	}
+
+	/// Moves the last element out and removes it, or returns nothing if the deque is empty
+	std::optional<T> try_pop_back()
+	{
+		if (empty())
+			return std::nullopt;
+		std::optional<T> value(std::move(back()));
+		pop_back();
+		return value;
+	}
+
+	/// Erases every element matching `predicate`, keeping the order of the rest.
+	/// Survivors are compacted in one pass and renumbered in another. Returns the number of erased elements.
+	template <typename Predicate>
+	std::size_t erase_if(Predicate predicate)
+	{
+		int64_t tombstonesBefore = 0;
+		if constexpr (tombstones)
+			tombstonesBefore = nodeData.deadCount;
+		auto write = nodeData.data.begin();
+		int64_t index = 0;
+		int64_t keptLeft = 0;
+		for (auto read = nodeData.data.begin(); read != nodeData.data.end() - 1; ++read, ++index)
+		{
+			Node *node = static_cast<Node *>(*read);
+			if (stable_deque_data::is_dead(node) || predicate(std::as_const(node->data)))
+			{
+				destroy_node(node);
+				continue;
+			}
+			if (index <= nodeData.middle)
+				keptLeft++;
+			*write++ = node;
+		}
+		std::size_t erased = nodeData.data.end() - 1 - write - tombstonesBefore;
+		*write++ = &endNode;
+		nodeData.data.erase(write, nodeData.data.end());
+		if constexpr (tombstones)
+			nodeData.ranks.clear();
+
+		nodeData.middle = keptLeft - 1;
+		renumber();
+		return erased;
+	}
+
+	/// Drops every tombstone (see `Options::tombstone_erase`) and renumbers, in one pass
+	void compact() requires tombstones
+	{
+		if (nodeData.deadCount > 0)
+			erase_if([](const T &) { return false; });
+	}
+
+	void clear()
+	{
+		erase_inner(0, nodeData.data.size() - 1);
+		// Nothing is left, so start over without any bias
+		nodeData.middle = -1;
+		renumber();
+	}
+
+	void resize(std::size_t count)
+	{
+		if constexpr (tombstones)
+			compact();
+		if (count < size())
+		{
+			erase_inner(count, size());
+			return;
+		}
+		insert_nodes<InsertInnerOptions::ForceRight>(end(), [&](NodeBuffer &newNodes) {
+			newNodes.reserve(count - size());
+			while (newNodes.size() < count - size())
+				newNodes.push_back(create_node<NodePlacement::Forward>());
+		});
+	}
+
+	void resize(std::size_t count, const T &value)
+	{
+		if constexpr (tombstones)
+			compact();
+		if (count < size())
+			erase_inner(count, size());
+		else
+			insert(end(), count - size(), value);
+	}
+
+	T &operator[](int64_t index)
+	{
+		assert(index >= 0 && index < (int64_t)size());
+		if constexpr (tombstones)
+		{
+			if (nodeData.deadCount > 0) [[unlikely]]
+				index = nodeData.live_index(0, index);
+		}
+		return static_cast<Node *>(nodeData.data[index])->data;
+	}
+
+	const T &operator[](int64_t index) const
+	{
+		assert(index >= 0 && index < (int64_t)size());
+		if constexpr (tombstones)
+		{
+			if (nodeData.deadCount > 0) [[unlikely]]
+				index = nodeData.live_index(0, index);
+		}
+		return static_cast<const Node *>(nodeData.data[index])->data;
+	}
+
+	/// Calls `function` on every element in order. Walks `stable_deque_data::data` directly, so the
+	/// node loads overlap instead of forming one dependent chain like `++iterator` does.
+	/// Prefetches `Options::prefetch_distance` nodes ahead.
+	template <typename Function>
+	void for_each(Function function)
+	{
+		walk_nodes<T>(nodeData.data, function);
+	}
+
+	template <typename Function>
+	void for_each(Function function) const
+	{
+		walk_nodes<const T>(nodeData.data, function);
+	}
+
+	/// Calls `function` with one random access range of `T&` per run of node pointers that are
+	/// contiguous inside `stable_deque_data::data` (a `std::deque` block), in order.
+	/// With `Options::prefetch_distance`, the nodes of the following segment are prefetched before `function` is called.
+	template <typename Function>
+	void for_each_segment(Function function)
+	{
+		walk_segments<T>(nodeData.data, function);
+	}
+
+	template <typename Function>
+	void for_each_segment(Function function) const
+	{
+		walk_segments<const T>(nodeData.data, function);
+	}
+};
+
+template <typename T, typename Allocator, typename Options, typename Predicate>
+std::size_t erase_if(stable_deque<T, Allocator, Options> &container, Predicate predicate)
+{
+	return container.erase_if(predicate);
+}
+
+namespace pmr
+{
+/// `stable_deque` that takes all of its memory from a `std::pmr::memory_resource`
+template <typename T, typename Options = stable_deque_options>
+using stable_deque = ::stable_deque<T, std::pmr::polymorphic_allocator<T>, Options>;
+} // namespace pmr
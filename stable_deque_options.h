@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+
+/// Compile-time knobs shared by `stable_deque` and `vector_stable_deque`.
+/// To change a knob for one instantiation, derive from this struct and shadow the member:
+///
+///     struct unpooled : stable_deque_options { static constexpr bool pooled_nodes = false; };
+///     stable_deque<int, std::allocator<int>, unpooled> sd;
+struct stable_deque_options
+{
+	/// Hand out nodes from an internal chunked pool (see `node_pool`) instead of doing
+	/// one allocator call per element
+	static constexpr bool pooled_nodes = true;
+
+	/// Upper bound (in bytes) of a single pool chunk. Chunks start small and double up to this.
+	static constexpr std::size_t pool_chunk_bytes = 64 * 1024;
+
+	/// `stable_deque` with `pooled_nodes` only. Nodes added at the back (and ranges) are carved out
+	/// of one chunk going up, nodes added at the front out of another going down, so growing at either
+	/// end keeps logically adjacent elements adjacent in memory. The free list is only used once the
+	/// current chunk runs out, which can leave up to one extra chunk partially used.
+	static constexpr bool ordered_node_placement = false;
+
+	/// `stable_deque` only. When non-zero, node positions are stored relative to blocks of
+	/// roughly this many neighbouring nodes, and every block carries its own base. A middle
+	/// insert/erase then renumbers inside a single block and rebases the blocks of the shorter
+	/// run, which is O(n / position_block_size + position_block_size) instead of O(n), so a
+	/// value near sqrt(n) works best. Position lookups cost one extra load.
+	static constexpr std::size_t position_block_size = 0;
+
+	/// `stable_deque` only, can't be combined with `position_block_size`. Nodes store a slot id
+	/// instead of their position, and positions live in one dense table indexed by slot, with the
+	/// slot ids kept parallel to the node pointers. Renumbering then streams through two arrays
+	/// with SIMD instead of touching every node, which pays off for large `T` only: every
+	/// insert/erase also moves the slot ids.
+	static constexpr bool slot_positions = false;
+
+	/// Erasing anywhere but at the ends only destroys the element and leaves its node behind as a
+	/// tombstone that iteration steps over, instead of shifting the node table and renumbering.
+	/// `compact()` drops every tombstone in one pass, which also runs on its own once tombstones make
+	/// up more than `tombstone_compact_percent` of the nodes, so a burst of middle erases is amortized
+	/// O(1). While tombstones exist, a rank index over the node table (`tombstone_ranks.h`) keeps
+	/// indexing and iterator distances O(log n), at an O(log n) update per erase.
+	static constexpr bool tombstone_erase = false;
+	static constexpr std::size_t tombstone_compact_percent = 25;
+
+	/// Count renumbering work, iterator side switches, node and pointer deque allocations, see
+	/// `stable_deque_stats`. Off by default, in which case none of it is compiled in.
+	static constexpr bool collect_stats = false;
+
+	/// How many nodes ahead `for_each` prefetches while walking (`for_each_segment` prefetches one
+	/// whole segment ahead instead). 0 disables prefetching in both. Off by default: the node loads
+	/// of a direct walk are already independent of each other, so an out-of-order core overlaps them
+	/// on its own (see `aged_sum_op` in `deque_bench`), but cores with a small reorder window can still gain from it.
+	static constexpr std::size_t prefetch_distance = 0;
+};
@@ -0,0 +1,239 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "stable_deque.h"
+
+/// Binary checkpoints of a `stable_deque` whose `T` is trivially copyable.
+///
+/// A snapshot is a `stable_deque_snapshot_header` followed by the elements, packed, in order. The
+/// header keeps how many of them were left of `middle`, so a reload is split the same way. Elements
+/// are stored as raw bytes, so a snapshot only loads on a machine with the same `T` layout and
+/// byte order.
+///
+/// `save_snapshot()` streams to a file descriptor through a small buffer, `load_snapshot()` reads
+/// one back the same way and `map_snapshot()` maps a file instead of reading it. Both loaders go
+/// through `stable_deque::assign_packed()`, which takes all nodes from one pool reservation.
+/// Failing system calls throw `std::system_error`, a malformed or truncated snapshot throws
+/// `std::runtime_error`.
+struct stable_deque_snapshot_header
+{
+	static constexpr char expectedMagic[8] = { 's', 't', 'd', 'q', 's', 'n', 'a', 'p' };
+	static constexpr uint32_t currentVersion = 1;
+
+	char magic[8];
+	uint32_t version;
+	uint32_t element_size;
+	uint64_t size;
+
+	/// Elements left of `middle`
+	uint64_t left_size;
+
+	/// Pads the header to 64 bytes, so a mapped payload is aligned for any usual `T`
+	uint8_t reserved[32];
+
+	/// Throws unless this is a snapshot of `elementSize` byte elements
+	void check(std::size_t elementSize) const
+	{
+		if (std::memcmp(magic, expectedMagic, sizeof(magic)) != 0)
+			throw std::runtime_error("stable_deque snapshot: bad magic");
+		if (version != currentVersion)
+			throw std::runtime_error("stable_deque snapshot: unsupported version");
+		if (element_size != elementSize)
+			throw std::runtime_error("stable_deque snapshot: element size mismatch");
+		if (left_size > size)
+			throw std::runtime_error("stable_deque snapshot: bad split");
+	}
+};
+
+static_assert(sizeof(stable_deque_snapshot_header) == 64);
+
+#if defined(__unix__) || defined(__APPLE__)
+
+namespace stable_deque_snapshot_detail
+{
+/// Bytes moved per `write()`/`read()` call
+constexpr std::size_t bufferBytes = 256 * 1024;
+
+inline void write_all(int fd, const void *bytes, std::size_t count)
+{
+	auto *cursor = static_cast<const char *>(bytes);
+	while (count > 0)
+	{
+		ssize_t written = ::write(fd, cursor, count);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::system_error(errno, std::generic_category(), "stable_deque snapshot: write");
+		}
+		cursor += written;
+		count -= written;
+	}
+}
+
+inline void read_all(int fd, void *bytes, std::size_t count)
+{
+	auto *cursor = static_cast<char *>(bytes);
+	while (count > 0)
+	{
+		ssize_t got = ::read(fd, cursor, count);
+		if (got < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::system_error(errno, std::generic_category(), "stable_deque snapshot: read");
+		}
+		if (got == 0)
+			throw std::runtime_error("stable_deque snapshot: truncated");
+		cursor += got;
+		count -= got;
+	}
+}
+} // namespace stable_deque_snapshot_detail
+
+/// Writes `container` to `fd`, starting at its current offset
+template <typename T, typename Allocator, typename Options>
+	requires std::is_trivially_copyable_v<T>
+void save_snapshot(const stable_deque<T, Allocator, Options> &container, int fd)
+{
+	using namespace stable_deque_snapshot_detail;
+
+	stable_deque_snapshot_header header{};
+	std::memcpy(header.magic, header.expectedMagic, sizeof(header.magic));
+	header.version = header.currentVersion;
+	header.element_size = sizeof(T);
+	header.size = container.size();
+	header.left_size = container.left_size();
+	write_all(fd, &header, sizeof(header));
+
+	// Gather the scattered nodes into a buffer and flush it whenever it fills up
+	std::vector<char> buffer(std::max(bufferBytes, sizeof(T)));
+	std::size_t used = 0;
+	container.for_each([&](const T &element) {
+		if (used + sizeof(T) > buffer.size())
+		{
+			write_all(fd, buffer.data(), used);
+			used = 0;
+		}
+		std::memcpy(buffer.data() + used, &element, sizeof(T));
+		used += sizeof(T);
+	});
+	write_all(fd, buffer.data(), used);
+}
+
+/// Replaces the contents of `container` with the snapshot read from `fd`, starting at its current
+/// offset. When `fd` is a regular file, a header claiming more elements than the rest of the file
+/// holds throws before `container` is touched.
+template <typename T, typename Allocator, typename Options>
+	requires std::is_trivially_copyable_v<T>
+void load_snapshot(stable_deque<T, Allocator, Options> &container, int fd)
+{
+	using namespace stable_deque_snapshot_detail;
+
+	stable_deque_snapshot_header header;
+	read_all(fd, &header, sizeof(header));
+	header.check(sizeof(T));
+	if (header.size > SIZE_MAX / sizeof(T))
+		throw std::runtime_error("stable_deque snapshot: bad size");
+	// A pipe or socket can't tell what is left, its payload is only checked while it's read
+	struct stat status;
+	if (::fstat(fd, &status) != 0)
+		throw std::system_error(errno, std::generic_category(), "stable_deque snapshot: fstat");
+	if (S_ISREG(status.st_mode))
+	{
+		off_t offset = ::lseek(fd, 0, SEEK_CUR);
+		if (offset < 0)
+			throw std::system_error(errno, std::generic_category(), "stable_deque snapshot: lseek");
+		if (status.st_size < offset || (uint64_t)(status.st_size - offset) / sizeof(T) < header.size)
+			throw std::runtime_error("stable_deque snapshot: truncated");
+	}
+
+	// Raw storage, `T` only has to be trivially copyable, not default constructible
+	struct Buffer
+	{
+		std::size_t capacity;
+		T *elements = std::allocator<T>().allocate(capacity);
+
+		~Buffer()
+		{
+			std::allocator<T>().deallocate(elements, capacity);
+		}
+	} buffer{std::max<std::size_t>(std::min<uint64_t>(bufferBytes / sizeof(T), header.size), 1)};
+
+	uint64_t remaining = header.size;
+	container.assign_packed(header.size, header.left_size, [&]() {
+		std::size_t count = std::min<uint64_t>(buffer.capacity, remaining);
+		read_all(fd, buffer.elements, count * sizeof(T));
+		remaining -= count;
+		return std::span<const T>(buffer.elements, count);
+	});
+}
+
+/// Like `load_snapshot()`, but maps the file at `path` and copies the elements straight out of the
+/// mapping, which saves the `read()` copy. The file must hold nothing but the snapshot.
+template <typename T, typename Allocator, typename Options>
+	requires std::is_trivially_copyable_v<T>
+void map_snapshot(stable_deque<T, Allocator, Options> &container, const char *path)
+{
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(), "stable_deque snapshot: open");
+
+	struct Mapping
+	{
+		int fd;
+		void *address = MAP_FAILED;
+		std::size_t length = 0;
+
+		~Mapping()
+		{
+			if (address != MAP_FAILED)
+				::munmap(address, length);
+			::close(fd);
+		}
+	} mapping{fd};
+
+	struct stat status;
+	if (::fstat(fd, &status) != 0)
+		throw std::system_error(errno, std::generic_category(), "stable_deque snapshot: fstat");
+	mapping.length = status.st_size;
+	if (mapping.length < sizeof(stable_deque_snapshot_header))
+		throw std::runtime_error("stable_deque snapshot: truncated");
+
+	mapping.address = ::mmap(nullptr, mapping.length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping.address == MAP_FAILED)
+		throw std::system_error(errno, std::generic_category(), "stable_deque snapshot: mmap");
+	::madvise(mapping.address, mapping.length, MADV_SEQUENTIAL);
+
+	const auto *header = static_cast<const stable_deque_snapshot_header *>(mapping.address);
+	header->check(sizeof(T));
+	if ((mapping.length - sizeof(*header)) / sizeof(T) < header->size)
+		throw std::runtime_error("stable_deque snapshot: truncated");
+
+	const T *elements = reinterpret_cast<const T *>(header + 1);
+	bool handedOut = false;
+	container.assign_packed(header->size, header->left_size, [&]() {
+		// Everything in one batch
+		std::size_t count = handedOut ? 0 : header->size;
+		handedOut = true;
+		return std::span<const T>(elements, count);
+	});
+}
+
+#endif
@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+/// Hot path counters of `stable_deque` and `vector_stable_deque`, only collected with
+/// `stable_deque_options::collect_stats`. Read them with `stats()`, clear them with `reset_stats()`.
+struct stable_deque_stats
+{
+	/// Nodes whose position a renumbering pass (`fix_up_pointers`) rewrote
+	uint64_t fix_up_nodes = 0;
+
+	/// Most nodes a single renumbering pass rewrote
+	uint64_t max_fix_up_nodes = 0;
+
+	/// `iterator::operator+=` calls that crossed `middle` (`stable_deque` only)
+	uint64_t iterator_side_switches = 0;
+
+	uint64_t node_allocations = 0;
+	uint64_t node_frees = 0;
+
+	/// Blocks the `std::deque` of node pointers allocated
+	uint64_t deque_block_allocations = 0;
+
+	/// Times the `std::deque` of node pointers allocated a new map, i.e. reallocated its index
+	uint64_t deque_map_reallocations = 0;
+
+	void record_fix_up(uint64_t nodes)
+	{
+		fix_up_nodes += nodes;
+		max_fix_up_nodes = std::max(max_fix_up_nodes, nodes);
+	}
+};
+
+/// Bytes held by `stable_deque`/`vector_stable_deque`, by category, as reported by `memory_usage()`
+struct stable_deque_memory_usage
+{
+	/// `size() * sizeof(T)`
+	std::size_t elements = 0;
+
+	/// What the nodes of the elements add on top of `T`: position, block link and padding
+	std::size_t node_overhead = 0;
+
+	/// Nodes of erased elements waiting for `compact()` (`tombstone_erase` only)
+	std::size_t tombstones = 0;
+
+	/// Pooled node storage that holds no element (free list and untouched chunk tails)
+	std::size_t idle_nodes = 0;
+
+	/// Chunk headers of the node pool
+	std::size_t pool_overhead = 0;
+
+	/// The `std::deque` of node pointers, estimated from libstdc++'s block layout
+	std::size_t node_table = 0;
+
+	/// Position blocks (`position_block_size`) or the slot table (`slot_positions`), and the rank
+	/// index over tombstones (`tombstone_erase`)
+	std::size_t positions = 0;
+
+	std::size_t total() const
+	{
+		return elements + node_overhead + tombstones + idle_nodes + pool_overhead + node_table + positions;
+	}
+};
+
+/// Lower bound of the bytes a `std::deque<Element>` of `size` elements holds: libstdc++ keeps
+/// `size / blockElements + 1` blocks of 512 bytes (or one element, if bigger) and a map of at
+/// least 8 block pointers. Blocks left over at either end after erasing aren't visible from outside.
+template <typename Element>
+std::size_t deque_bytes_estimate(std::size_t size)
+{
+	constexpr std::size_t blockElements = sizeof(Element) < 512 ? 512 / sizeof(Element) : 1;
+	std::size_t blocks = size / blockElements + 1;
+	return blocks * blockElements * sizeof(Element) + std::max<std::size_t>(8, blocks + 2) * sizeof(Element *);
+}
+
+/// Allocator adaptor for the `std::deque` of node pointers that counts its block and map allocations.
+/// Allocations of `Element` are blocks, anything else the deque allocates (`Element*`) is its map.
+template <typename Base, typename Element>
+struct stats_counting_allocator : Base
+{
+	using BaseTraits = std::allocator_traits<Base>;
+	using value_type = typename BaseTraits::value_type;
+
+	template <typename U>
+	struct rebind
+	{
+		using other = stats_counting_allocator<typename BaseTraits::template rebind_alloc<U>, Element>;
+	};
+
+	/// The counters belong to one container, so the allocator never follows the memory it handed
+	/// out to another one
+	using propagate_on_container_copy_assignment = std::false_type;
+	using propagate_on_container_move_assignment = std::false_type;
+	using propagate_on_container_swap = std::false_type;
+	using is_always_equal = typename BaseTraits::is_always_equal;
+
+	stable_deque_stats *stats = nullptr;
+
+	stats_counting_allocator() = default;
+
+	explicit stats_counting_allocator(stable_deque_stats *stats, const Base &base = Base()) : Base(base), stats(stats)
+	{
+	}
+
+	template <typename OtherBase>
+	stats_counting_allocator(const stats_counting_allocator<OtherBase, Element> &other) : Base(other), stats(other.stats)
+	{
+	}
+
+	value_type *allocate(std::size_t count)
+	{
+		if (stats != nullptr)
+		{
+			if constexpr (std::is_same_v<value_type, Element>)
+				stats->deque_block_allocations++;
+			else
+				stats->deque_map_reallocations++;
+		}
+		return BaseTraits::allocate(*this, count);
+	}
+
+	void deallocate(value_type *pointer, std::size_t count)
+	{
+		BaseTraits::deallocate(*this, pointer, count);
+	}
+
+	template <typename OtherBase>
+	friend bool operator==(const stats_counting_allocator &left, const stats_counting_allocator<OtherBase, Element> &right)
+	{
+		return static_cast<const Base &>(left) == static_cast<const OtherBase &>(right);
+	}
+};
@@ -0,0 +1,217 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// Rank index over a node table with tombstones (`stable_deque_options::tombstone_erase`), used by
+/// `stable_deque` and `vector_stable_deque`.
+///
+/// A Fenwick tree holds 1 for every live node (the end node included) and 0 for every tombstone,
+/// so the number of live nodes in front of a table index, and the table index of the k-th live
+/// node, take O(log n) instead of a walk over the tombstones.
+///
+/// Slot `frontSlot + i` stands for table index `i`. Popping from the front only moves `frontSlot`,
+/// pushing to the front reuses the slots in front of it, and pushing or popping right before the
+/// end node grows or truncates the tree, each in O(log n). Any other change to the table rebuilds
+/// the tree in one pass, or drops it if no tombstone is left.
+///
+/// An empty tree means the index is off. The container builds it when its first tombstone
+/// appears, so a deque that never buries an element never pays for it.
+template <typename Allocator>
+class tombstone_ranks
+{
+	/// 1 based, `tree[i]` sums the `i & -i` slots that end with slot `i - 1`
+	std::vector<int64_t, Allocator> tree;
+	int64_t frontSlot = 0;
+
+	/// Sum of the slots [0, slotCount)
+	int64_t prefix(int64_t slotCount) const
+	{
+		int64_t sum = 0;
+		for (; slotCount > 0; slotCount &= slotCount - 1)
+			sum += tree[slotCount];
+		return sum;
+	}
+
+	void add(int64_t slot, int64_t amount)
+	{
+		for (int64_t i = slot + 1; i < (int64_t)tree.size(); i += i & -i)
+			tree[i] += amount;
+	}
+
+	void set(int64_t slot, int64_t value)
+	{
+		add(slot, value - (prefix(slot + 1) - prefix(slot)));
+	}
+
+	void append(int64_t value)
+	{
+		int64_t i = tree.size();
+		tree.push_back(value + prefix(i - 1) - prefix(i - (i & -i)));
+	}
+
+	/// Free slots a rebuild leaves in front of a table of `size` nodes, so pushing to the front
+	/// doesn't rebuild every time
+	static int64_t headroom(int64_t size)
+	{
+		return size / 4 + 8;
+	}
+
+	template <typename IsLive>
+	void rebuild(int64_t size, int64_t tombstones, IsLive isLive)
+	{
+		if (tombstones == 0)
+			clear();
+		else
+			build(size, isLive);
+	}
+
+public:
+	explicit tombstone_ranks(const Allocator &allocator) : tree(allocator)
+	{
+	}
+
+	bool empty() const
+	{
+		return tree.empty();
+	}
+
+	void clear()
+	{
+		tree.clear();
+		frontSlot = 0;
+	}
+
+	std::size_t allocated_bytes() const
+	{
+		return tree.capacity() * sizeof(int64_t);
+	}
+
+	/// Builds the index for a table of `size` nodes, the node at `index` being live if `isLive(index)`
+	template <typename IsLive>
+	void build(int64_t size, IsLive isLive)
+	{
+		frontSlot = headroom(size);
+		tree.assign(frontSlot + size + 1, 0);
+		for (int64_t index = 0; index < size; index++)
+			tree[frontSlot + index + 1] = isLive(index) ? 1 : 0;
+		for (int64_t i = 1; i < (int64_t)tree.size(); i++)
+		{
+			int64_t parent = i + (i & -i);
+			if (parent < (int64_t)tree.size())
+				tree[parent] += tree[i];
+		}
+	}
+
+	/// Same as `build()` for a table without tombstones, without looking at it
+	void build_live(int64_t size)
+	{
+		frontSlot = headroom(size);
+		tree.resize(frontSlot + size + 1);
+		tree[0] = 0;
+		// `tree[i]` covers the slots [i - (i & -i), i), the live ones start at `frontSlot`
+		for (int64_t i = 1; i < (int64_t)tree.size(); i++)
+			tree[i] = std::max<int64_t>(i - std::max(i - (i & -i), frontSlot), 0);
+	}
+
+	/// Live nodes stored in [0, index) of the table
+	int64_t live_before(int64_t index) const
+	{
+		return prefix(frontSlot + index) - prefix(frontSlot);
+	}
+
+	/// Table index of the live node that has `rank` live nodes in front of it
+	int64_t index_of(int64_t rank) const
+	{
+		// Descends to the longest run of slots whose sum stays below the target
+		int64_t target = prefix(frontSlot) + rank + 1;
+		int64_t slots = 0;
+		for (int64_t step = std::bit_floor(tree.size() - 1); step > 0; step >>= 1)
+		{
+			if (slots + step < (int64_t)tree.size() && tree[slots + step] < target)
+			{
+				slots += step;
+				target -= tree[slots];
+			}
+		}
+		return slots - frontSlot;
+	}
+
+	/// The node at `index` became a tombstone
+	void bury(int64_t index)
+	{
+		add(frontSlot + index, -1);
+	}
+
+	/// `count` live nodes were inserted at `index`. The table now holds `size` nodes, `tombstones` of
+	/// them dead, and `isLive` tells them apart in case the tree has to be rebuilt.
+	template <typename IsLive>
+	void inserted(int64_t index, int64_t count, int64_t size, int64_t tombstones, IsLive isLive)
+	{
+		if (tree.empty())
+			return;
+		if (index + count == size - 1)
+		{
+			// Right in front of the end node, whose old slot now belongs to the first new node
+			for (int64_t i = 0; i < count; i++)
+				append(1);
+		}
+		else if (index == 0 && count <= frontSlot)
+		{
+			frontSlot -= count;
+			for (int64_t i = 0; i < count; i++)
+				set(frontSlot + i, 1);
+		}
+		else
+		{
+			rebuild(size, tombstones, isLive);
+		}
+	}
+
+	/// `count` nodes were removed at `index`, same arguments as `inserted()` otherwise
+	template <typename IsLive>
+	void removed(int64_t index, int64_t count, int64_t size, int64_t tombstones, IsLive isLive)
+	{
+		if (tree.empty())
+			return;
+		if (size == 1)
+		{
+			clear();
+		}
+		else if (index == 0)
+		{
+			frontSlot += count;
+			// A queue keeps popping at the front, so the popped slots are let go once they outnumber the table
+			if (frontSlot > size + headroom(size))
+				rebuild(size, tombstones, isLive);
+		}
+		else if (index == size - 1)
+		{
+			// Right in front of the end node, which moves back into the first removed slot
+			tree.resize(tree.size() - count);
+			set(frontSlot + index, 1);
+		}
+		else
+		{
+			rebuild(size, tombstones, isLive);
+		}
+	}
+
+	/// Exchanges the trees, element by element if their allocators can't free each other's memory
+	void swap(tombstone_ranks &other)
+	{
+		if (tree.get_allocator() == other.tree.get_allocator())
+		{
+			tree.swap(other.tree);
+		}
+		else
+		{
+			std::vector<int64_t, Allocator> held(std::move(tree));
+			tree = std::move(other.tree);
+			other.tree = std::move(held);
+		}
+		std::swap(frontSlot, other.frontSlot);
+	}
+};
@@ -1,32 +1,99 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
 #include <deque>
 #include <memory>
 #include <cassert>
+#include <iterator>
+#include <memory_resource>
+#include <ranges>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "node_pool.h"
+#include "prefetch.h"
+#include "stable_deque_options.h"
+#include "stable_deque_stats.h"
+#include "tombstone_ranks.h"
 
 // A stable deque implementation
-template <typename T, typename Allocator = std::allocator<T>>
+template <typename T, typename Allocator = std::allocator<T>, typename Options = stable_deque_options>
 class vector_stable_deque
 {
-    struct Node
+    static constexpr bool tombstones = Options::tombstone_erase;
+
+    struct NoTombstones
+    {
+    };
+
+    // the end node is only a `NodeBase`, so it never holds (or constructs) a `T`
+    struct NodeBase
     {
-        T data;
         // I just don't want to have to think about
         // subtracing from size_t, so int64_t it is!
         int64_t pos_in_nodes;
+
+        // only with `Options::tombstone_erase`: 1 if the element was erased and the node waits
+        // for `compact()`. the end node counts the tombstones in `nodes` instead, which keeps the
+        // count reachable from an iterator
+        [[no_unique_address]] std::conditional_t<tombstones, int64_t, NoTombstones> dead{};
+    };
+
+    struct Node : NodeBase
+    {
+        T data;
+
+        // constructs `data` in place from `args`
+        template <typename... Args>
+        Node(int64_t pos_in_nodes, Args &&...args) : NodeBase{pos_in_nodes}, data(std::forward<Args>(args)...)
+        {
+        }
     };
 
-    using NodePAllocator = std::allocator_traits<Allocator>::template rebind_alloc<Node *>;
+    using NodePAllocator = std::allocator_traits<Allocator>::template rebind_alloc<NodeBase *>;
     using NodePAllocatorTraits = std::allocator_traits<NodePAllocator>;
 
+    using AllocatorTraits = std::allocator_traits<Allocator>;
     using NodeAllocator = std::allocator_traits<Allocator>::template rebind_alloc<Node>;
     using NodeAllocatorTraits = std::allocator_traits<NodeAllocator>;
 
-    using NodesDeque = std::deque<Node *, NodePAllocator>;
+    static constexpr bool collectStats = Options::collect_stats;
+    using NodesDequeAllocator = std::conditional_t<collectStats, stats_counting_allocator<NodePAllocator, NodeBase *>, NodePAllocator>;
+    using NodesDeque = std::deque<NodeBase *, NodesDequeAllocator>;
 
-    class iterator
+    struct Unused
+    {
+        Unused() = default;
+
+        // stands in for members that are built from the container's allocator
+        explicit Unused(const Allocator &)
+        {
+        }
+    };
+
+    using RanksAllocator = std::allocator_traits<Allocator>::template rebind_alloc<int64_t>;
+
+    // the sentinel returned by `end()`. with `Options::tombstone_erase` it also keeps the rank
+    // index over the tombstones, built by the first one, so an iterator reaches it like their count
+    struct EndNode : NodeBase
+    {
+        [[no_unique_address]] std::conditional_t<tombstones, tombstone_ranks<RanksAllocator>, Unused> ranks;
+
+        explicit EndNode(const Allocator &allocator) : ranks(allocator)
+        {
+        }
+    };
+
+    template <bool isConst>
+    class basic_iterator
     {
         friend class vector_stable_deque;
+        template <bool>
+        friend class basic_iterator;
+
+        using NodesPointer = std::conditional_t<isConst, const NodesDeque *, NodesDeque *>;
 
         // Unlike a stable_vector, we need one additional pointer to store the deque that
         // contains our actual `Node` data.
@@ -34,222 +101,1011 @@ class vector_stable_deque
         // a contiguous vector (pointer arithmetic iterates to the next node), a vector_stable_deque
         // is backed by a non-contiguous container (a deque).
         // Therefore we require an additional pointer so that we have a way to fetch "the next node".
-        NodesDeque &nodes_ref;
-        Node *node;
+        NodesPointer nodes_ptr = nullptr;
+        NodeBase *node = nullptr;
 
-        iterator(Node *node, NodesDeque &nodes_ref) : node(node), nodes_ref(nodes_ref)
+        basic_iterator(NodeBase *node, NodesPointer nodes_ptr) : nodes_ptr(nodes_ptr), node(node)
         {
         }
 
+        // elements between `other` and this iterator, stepping over tombstones
+        int64_t distance_from(const basic_iterator &other) const
+        {
+            int64_t index = node->pos_in_nodes;
+            int64_t otherIndex = other.node->pos_in_nodes;
+            if constexpr (tombstones)
+            {
+                if (nodes_ptr->back()->dead > 0) [[unlikely]]
+                {
+                    if (index >= otherIndex)
+                        return live_count(*nodes_ptr, otherIndex, index);
+                    return -live_count(*nodes_ptr, index, otherIndex);
+                }
+            }
+            return index - otherIndex;
+        }
+
+        // index in `nodes` of the node `offset` elements away, stepping over tombstones
+        int64_t index_after(int64_t offset) const
+        {
+            int64_t index = node->pos_in_nodes + offset;
+            if constexpr (tombstones)
+            {
+                if (nodes_ptr->back()->dead > 0) [[unlikely]]
+                    index = live_index(*nodes_ptr, node->pos_in_nodes, offset);
+            }
+            return index;
+        }
+
     public:
-        iterator(const iterator &iter) : nodes_ref(iter.nodes_ref), node(iter.node)
+        using iterator_category = std::random_access_iterator_tag;
+        using iterator_concept = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<isConst, const T *, T *>;
+        using reference = std::conditional_t<isConst, const T &, T &>;
+
+        basic_iterator() = default;
+        basic_iterator(const basic_iterator &) = default;
+        basic_iterator &operator=(const basic_iterator &) = default;
+
+        // `iterator` converts to `const_iterator`
+        template <bool wasConst>
+            requires(isConst && !wasConst)
+        basic_iterator(const basic_iterator<wasConst> &iter) : nodes_ptr(iter.nodes_ptr), node(iter.node)
+        {
+        }
+
+        reference operator*() const
         {
+            return static_cast<Node *>(node)->data;
         }
 
-        T &operator*() const
+        pointer operator->() const
         {
-            return node->data;
+            return &static_cast<Node *>(node)->data;
         }
 
         // Increment / Decrement
-        iterator &operator++()
+        basic_iterator &operator++()
         {
             *this += 1;
             return *this;
         }
 
-        iterator &operator++(int)
+        basic_iterator operator++(int)
         {
+            basic_iterator tmp(*this);
             *this += 1;
-            return *this;
+            return tmp;
         }
 
-        iterator &operator--()
+        basic_iterator &operator--()
         {
             *this -= 1;
             return *this;
         }
 
-        iterator &operator--(int)
+        basic_iterator operator--(int)
         {
+            basic_iterator tmp(*this);
             *this -= 1;
-            return *this;
+            return tmp;
         }
 
-        T &operator[](int64_t offset) const
+        reference operator[](difference_type offset) const
         {
-            return nodes_ref[node->pos_in_nodes + offset]->data;
+            return static_cast<Node *>((*nodes_ptr)[index_after(offset)])->data;
         }
 
-        iterator &operator+=(int64_t offset)
+        basic_iterator &operator+=(difference_type offset)
         {
-            node = nodes_ref[node->pos_in_nodes + offset];
+            node = (*nodes_ptr)[index_after(offset)];
             return *this;
         }
 
-        iterator &operator-=(int64_t offset)
+        basic_iterator &operator-=(difference_type offset)
         {
             *this += -offset;
             return *this;
         }
 
-        friend iterator operator+(const iterator &left, int64_t offset)
+        friend basic_iterator operator+(const basic_iterator &left, difference_type offset)
         {
-            iterator tmp(left);
+            basic_iterator tmp(left);
             tmp += offset;
             return tmp;
         }
 
-        friend iterator operator+(int64_t offset, const iterator &right)
+        friend basic_iterator operator+(difference_type offset, const basic_iterator &right)
         {
-            iterator tmp(right);
+            basic_iterator tmp(right);
             tmp += offset;
             return tmp;
         }
 
-        friend iterator operator-(const iterator &left, int64_t offset)
+        friend basic_iterator operator-(const basic_iterator &left, difference_type offset)
         {
-            iterator tmp(left);
+            basic_iterator tmp(left);
             tmp -= offset;
             return tmp;
         }
 
-        friend int64_t operator-(const iterator &left, const iterator &right)
+        friend difference_type operator-(const basic_iterator &left, const basic_iterator &right)
         {
-            return left.node->pos_in_nodes - right.node->pos_in_nodes;
+            return left.distance_from(right);
         }
 
         // Comparison operators
-        friend bool operator==(const iterator &l, const iterator &r)
+        friend bool operator==(const basic_iterator &l, const basic_iterator &r)
         {
             return l.node == r.node;
         }
 
-        friend bool operator!=(const iterator &l, const iterator &r)
+        friend bool operator!=(const basic_iterator &l, const basic_iterator &r)
         {
             return l.node != r.node;
         }
 
-        friend bool operator<(const iterator &l, const iterator &r)
+        friend bool operator<(const basic_iterator &l, const basic_iterator &r)
         {
             return l.node->pos_in_nodes < r.node->pos_in_nodes;
         }
 
-        friend bool operator<=(const iterator &l, const iterator &r)
+        friend bool operator<=(const basic_iterator &l, const basic_iterator &r)
         {
             return l.node->pos_in_nodes <= r.node->pos_in_nodes;
         }
 
-        friend bool operator>(const iterator &l, const iterator &r)
+        friend bool operator>(const basic_iterator &l, const basic_iterator &r)
         {
             return l.node->pos_in_nodes > r.node->pos_in_nodes;
         }
 
-        friend bool operator>=(const iterator &l, const iterator &r)
+        friend bool operator>=(const basic_iterator &l, const basic_iterator &r)
         {
             return l.node->pos_in_nodes >= r.node->pos_in_nodes;
         }
     };
 
-    template <int howMuchToMove>
-    void fix_up_pointers(iterator iter, iterator end)
+public:
+    using value_type = T;
+    using allocator_type = Allocator;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = T &;
+    using const_reference = const T &;
+    using pointer = T *;
+    using const_pointer = const T *;
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+private:
+
+    static bool is_dead(const NodeBase *node)
     {
-        while (true)
+        if constexpr (tombstones)
+            return node->dead != 0;
+        else
+            return false;
+    }
+
+    static const auto &ranks_of(const NodesDeque &nodes)
+    {
+        return static_cast<const EndNode *>(nodes.back())->ranks;
+    }
+
+    // the end node's count isn't a mark
+    static bool is_live(const NodesDeque &nodes, int64_t index)
+    {
+        return index == (int64_t)nodes.size() - 1 || !is_dead(nodes[index]);
+    }
+
+    // index of the node `offset` live nodes away from the one at `index`, only while tombstones exist
+    static int64_t live_index(const NodesDeque &nodes, int64_t index, int64_t offset)
+    {
+        // `++`/`--` mostly find a live neighbour within a few nodes, without going through the ranks
+        if (offset == 1 || offset == -1)
         {
-            iter.node->pos_in_nodes += howMuchToMove;
-            if (iter == end)
-                return;
-            iter++;
+            int64_t next = index + offset;
+            for (int i = 0; i < 8; i++, next += offset)
+                if (is_live(nodes, next))
+                    return next;
         }
+        const auto &ranks = ranks_of(nodes);
+        return ranks.index_of(ranks.live_before(index) + offset);
+    }
+
+    // live nodes in [first, last) of `nodes`, only while tombstones exist
+    static int64_t live_count(const NodesDeque &nodes, int64_t first, int64_t last)
+    {
+        const auto &ranks = ranks_of(nodes);
+        return ranks.live_before(last) - ranks.live_before(first);
+    }
+
+    // keeps the rank index up to date after `count` nodes were linked in at `index`
+    void ranks_inserted(int64_t index, int64_t count)
+    {
+        if constexpr (tombstones)
+            endNode.ranks.inserted(index, count, nodes.size(), endNode.dead, [this](int64_t i) { return is_live(nodes, i); });
     }
 
+    // same after `count` nodes at `index` were taken out of `nodes`
+    void ranks_removed(int64_t index, int64_t count)
+    {
+        if constexpr (tombstones)
+            endNode.ranks.removed(index, count, nodes.size(), endNode.dead, [this](int64_t i) { return is_live(nodes, i); });
+    }
+
+    // shifts `pos_in_nodes` of the nodes in `[first, nodes.size())`, the end node included
+    void fix_up_pointers(int64_t first, int64_t howMuchToMove)
+    {
+        for (auto iter = nodes.begin() + first; iter != nodes.end(); ++iter)
+            (*iter)->pos_in_nodes += howMuchToMove;
+        if constexpr (collectStats)
+            statCounters->record_fix_up(nodes.size() - first);
+    }
+
+    // only used with `Options::collect_stats`, on the heap so `nodes`' allocator can point to it
+    std::conditional_t<collectStats, std::unique_ptr<stable_deque_stats>, Unused> statCounters;
+
     NodeAllocator nodeAllocator;
     NodesDeque nodes;
 
+    // only used with `Options::pooled_nodes`
+    node_pool<Node, NodeAllocator, Options::pool_chunk_bytes> nodePool;
+
+    Node *allocate_node()
+    {
+        if constexpr (collectStats)
+            statCounters->node_allocations++;
+        if constexpr (Options::pooled_nodes)
+            return nodePool.allocate(nodeAllocator);
+        else
+            return NodeAllocatorTraits::allocate(nodeAllocator, 1);
+    }
+
+    void destroy_node(Node *node)
+    {
+        if constexpr (collectStats)
+            statCounters->node_frees++;
+        bool alive = true;
+        if constexpr (tombstones)
+        {
+            // a tombstone's element is already destroyed
+            alive = !node->dead;
+            endNode.dead -= !alive;
+        }
+        if (alive)
+            NodeAllocatorTraits::destroy(nodeAllocator, node);
+        if constexpr (Options::pooled_nodes)
+            nodePool.deallocate(node);
+        else
+            NodeAllocatorTraits::deallocate(nodeAllocator, node, 1);
+    }
+
+    // allocates a node and constructs its `T` from `args`
+    template <typename... Args>
+    Node *create_node(int64_t pos_in_nodes, Args &&...args)
+    {
+        Node *data = allocate_node();
+        try
+        {
+            NodeAllocatorTraits::construct(nodeAllocator, data, pos_in_nodes, std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            if constexpr (Options::pooled_nodes)
+                nodePool.deallocate(data);
+            else
+                NodeAllocatorTraits::deallocate(nodeAllocator, data, 1);
+            throw;
+        }
+        return data;
+    }
+
+    // removes the tombstones that reached either end, so the first and last node are always live
+    void trim_tombstones()
+    {
+        int64_t leading = 0;
+        while (leading < (int64_t)nodes.size() - 1 && is_dead(nodes[leading]))
+            leading++;
+        if (leading > 0)
+        {
+            for (int64_t index = 0; index < leading; index++)
+                destroy_node(static_cast<Node *>(nodes[index]));
+            nodes.erase(nodes.begin(), nodes.begin() + leading);
+            ranks_removed(0, leading);
+            fix_up_pointers(0, -leading);
+        }
+
+        int64_t last = nodes.size() - 1;
+        int64_t first = last;
+        while (first > 0 && is_dead(nodes[first - 1]))
+            first--;
+        if (first < last)
+        {
+            for (int64_t index = first; index < last; index++)
+                destroy_node(static_cast<Node *>(nodes[index]));
+            nodes.erase(nodes.begin() + first, nodes.begin() + last);
+            ranks_removed(first, last - first);
+            fix_up_pointers(first, first - last);
+        }
+    }
+
+    // destroys the element of a node that isn't at either end but leaves the node in place
+    iterator bury(Node *node, iterator next)
+    {
+        std::destroy_at(&node->data);
+        // every other node is live when the first tombstone appears
+        if (endNode.ranks.empty())
+            endNode.ranks.build_live(nodes.size());
+        endNode.ranks.bury(node->pos_in_nodes);
+        node->dead = 1;
+        endNode.dead++;
+        if (endNode.dead * 100 > (int64_t)(nodes.size() - 1) * (int64_t)Options::tombstone_compact_percent)
+            compact();
+        return next;
+    }
+
+    // traversal helpers for `for_each`/`for_each_segment`, `Value` is `T` or `const T`
+    template <typename Value>
+    static auto make_segment(NodeBase *const *first, NodeBase *const *last)
+    {
+        return std::span<NodeBase *const>(first, last) |
+               std::views::transform([](NodeBase *node) -> Value & { return static_cast<Node *>(node)->data; });
+    }
+
+    template <typename Value, typename Nodes, typename Function>
+    static void walk_nodes(Nodes &nodes, Function &function)
+    {
+        // skip the end node
+        auto end = nodes.end() - 1;
+        auto iter = nodes.begin();
+        auto ahead = iter + std::min<std::ptrdiff_t>(Options::prefetch_distance, end - iter);
+        for (; iter != end; ++iter)
+        {
+            if constexpr (Options::prefetch_distance > 0)
+            {
+                if (ahead != end)
+                {
+                    prefetch_for_read(*ahead);
+                    ++ahead;
+                }
+            }
+            if (is_dead(*iter))
+                continue;
+            function(static_cast<Value &>(static_cast<Node *>(*iter)->data));
+        }
+    }
+
+    template <typename Value, typename Nodes, typename Function>
+    static void walk_segments(Nodes &nodes, Function &function)
+    {
+        auto end = nodes.end() - 1;
+        auto iter = nodes.begin();
+        // splits off the run of node pointers that `std::deque` stores next to each other.
+        // tombstones end a run and are skipped (the first node is never one)
+        auto nextRun = [&]() {
+            NodeBase *const *first = &*iter;
+            NodeBase *const *last = first;
+            while (iter != end && &*iter == last && !is_dead(*iter))
+            {
+                ++iter;
+                ++last;
+            }
+            while (iter != end && is_dead(*iter))
+                ++iter;
+            return std::pair{first, last};
+        };
+
+        if (iter == end)
+            return;
+        auto run = nextRun();
+        while (true)
+        {
+            bool isLast = iter == end;
+            auto next = run;
+            if (!isLast)
+            {
+                // get the next segment's nodes on their way while `function` works on this one
+                next = nextRun();
+                if constexpr (Options::prefetch_distance > 0)
+                {
+                    for (auto node = next.first; node != next.second; ++node)
+                        prefetch_for_read(*node);
+                }
+            }
+            function(make_segment<Value>(run.first, run.second));
+            if (isLast)
+                return;
+            run = next;
+        }
+    }
+
+    // always the last entry of `nodes`
+    EndNode endNode;
+
     void shared_init()
     {
         // add end node
-        Node *data = NodeAllocatorTraits::allocate(nodeAllocator, 1);
-        NodeAllocatorTraits::construct(
-            nodeAllocator,
-            data,
-            *((T *)alloca(sizeof(T))), // garbage memory
-            nodes.size());
-        nodes.push_back(data);
+        endNode.pos_in_nodes = nodes.size();
+        nodes.push_back(&endNode);
+    }
+
+    // fills an empty container with the elements of `other`, copied out of a `const` one and
+    // moved out of any other: one pool reservation for the nodes, and `nodes` is sized once and
+    // filled in place
+    template <typename Source>
+    void copy_from(Source &other)
+    {
+        int64_t count = other.size();
+        reserve(count);
+
+        nodes.assign(count + 1, nullptr);
+        nodes.back() = &endNode;
+        auto write = nodes.begin();
+        int64_t index = 0;
+        try
+        {
+            other.for_each([&](auto &element) {
+                if constexpr (std::is_const_v<Source>)
+                    *write++ = create_node(index, element);
+                else
+                    *write++ = create_node(index, std::move(element));
+                index++;
+            });
+        }
+        catch (...)
+        {
+            // keep what made it in
+            nodes.erase(write, nodes.end() - 1);
+            endNode.pos_in_nodes = index;
+            throw;
+        }
+        endNode.pos_in_nodes = count;
+    }
+
+    // creates `statCounters` first with `Options::collect_stats`, `nodes` is built with this
+    NodesDequeAllocator nodes_deque_allocator(const Allocator &allocator)
+    {
+        if constexpr (collectStats)
+        {
+            statCounters = std::make_unique<stable_deque_stats>();
+            return NodesDequeAllocator(statCounters.get(), NodePAllocator(allocator));
+        }
+        else
+        {
+            return NodesDequeAllocator(allocator);
+        }
+    }
+
+    // everything `swap()` exchanges, the allocators only with `withAllocators` (they must
+    // compare equal otherwise). `nodes` goes element by element if its allocators differ
+    template <bool withAllocators>
+    void swap_storage(vector_stable_deque &other)
+    {
+        using std::swap;
+        if constexpr (withAllocators)
+            swap(nodeAllocator, other.nodeAllocator);
+        nodePool.swap(other.nodePool);
+        if (nodes.get_allocator() == other.nodes.get_allocator())
+        {
+            nodes.swap(other.nodes);
+        }
+        else
+        {
+            NodesDeque held(std::move(nodes));
+            nodes = std::move(other.nodes);
+            other.nodes = std::move(held);
+        }
+
+        // the end nodes are part of the containers, so only their state changes hands
+        swap(static_cast<NodeBase &>(endNode), static_cast<NodeBase &>(other.endNode));
+        if constexpr (tombstones)
+            endNode.ranks.swap(other.endNode.ranks);
+        nodes.back() = &endNode;
+        other.nodes.back() = &other.endNode;
     }
 
 public:
-    vector_stable_deque()
+    vector_stable_deque() : vector_stable_deque(Allocator())
     {
-        nodeAllocator = NodeAllocator();
-        nodes = NodesDeque(NodePAllocator());
-        shared_init();
     }
-    vector_stable_deque(const Allocator &allocator)
+    vector_stable_deque(const Allocator &allocator) :
+        nodeAllocator(allocator), nodes(nodes_deque_allocator(allocator)), endNode(allocator)
     {
-        nodeAllocator = allocator;
-        nodes = NodesDeque(allocator);
         shared_init();
     }
+
+    // copies the elements, not the tombstones, the stats or the spare pool capacity of `other`.
+    // the allocator comes from `select_on_container_copy_construction()`
+    vector_stable_deque(const vector_stable_deque &other) :
+        vector_stable_deque(other, AllocatorTraits::select_on_container_copy_construction(other.get_allocator()))
+    {
+    }
+
+    vector_stable_deque(const vector_stable_deque &other, const std::type_identity_t<Allocator> &allocator) :
+        vector_stable_deque(allocator)
+    {
+        copy_from(other);
+    }
+
+    // takes the nodes of `other` without touching them, which leaves `other` empty
+    vector_stable_deque(vector_stable_deque &&other) : vector_stable_deque(other.get_allocator())
+    {
+        swap_storage<false>(other);
+    }
+
+    // moves the elements one by one if `allocator` differs from the one of `other`
+    vector_stable_deque(vector_stable_deque &&other, const std::type_identity_t<Allocator> &allocator) :
+        vector_stable_deque(allocator)
+    {
+        if (get_allocator() == other.get_allocator())
+            swap_storage<false>(other);
+        else
+            copy_from(other);
+    }
+
+    vector_stable_deque &operator=(const vector_stable_deque &other)
+    {
+        if (this != &other)
+        {
+            constexpr bool propagate = AllocatorTraits::propagate_on_container_copy_assignment::value;
+            vector_stable_deque copy(other, propagate ? other.get_allocator() : get_allocator());
+            swap_storage<propagate>(copy);
+        }
+        return *this;
+    }
+
+    vector_stable_deque &operator=(vector_stable_deque &&other)
+    {
+        if (this != &other)
+        {
+            constexpr bool propagate = AllocatorTraits::propagate_on_container_move_assignment::value;
+            vector_stable_deque moved(std::move(other), propagate ? other.get_allocator() : get_allocator());
+            swap_storage<propagate>(moved);
+        }
+        return *this;
+    }
+
+    // exchanges the contents in O(1), the nodes stay where they are. references to elements
+    // stay valid, iterators point into the container and must be obtained again. the stats
+    // stay with their container, the allocators are only exchanged with
+    // `propagate_on_container_swap` (they must compare equal otherwise)
+    void swap(vector_stable_deque &other) noexcept(!AllocatorTraits::propagate_on_container_swap::value || AllocatorTraits::is_always_equal::value)
+    {
+        constexpr bool propagate = AllocatorTraits::propagate_on_container_swap::value;
+        assert(propagate || get_allocator() == other.get_allocator());
+        swap_storage<propagate>(other);
+    }
+
+    friend void swap(vector_stable_deque &left, vector_stable_deque &right) noexcept(noexcept(left.swap(right)))
+    {
+        left.swap(right);
+    }
+
+    allocator_type get_allocator() const
+    {
+        return allocator_type(nodeAllocator);
+    }
+
     ~vector_stable_deque()
     {
-        for (auto *node : nodes)
+        // skip the end node, it is part of `this`
+        for (auto iter = nodes.begin(); iter != nodes.end() - 1; ++iter)
         {
-            NodeAllocatorTraits::destroy(nodeAllocator, node);
-            NodeAllocatorTraits::deallocate(nodeAllocator, node, 1);
+            Node *node = static_cast<Node *>(*iter);
+            if (!is_dead(node))
+                NodeAllocatorTraits::destroy(nodeAllocator, node);
+            if constexpr (!Options::pooled_nodes)
+                NodeAllocatorTraits::deallocate(nodeAllocator, node, 1);
         }
         nodes.clear();
+        // pooled nodes are freed chunk by chunk
+        nodePool.release(nodeAllocator);
     }
 
     iterator begin()
     {
-        return iterator(nodes[0], nodes);
+        return iterator(nodes[0], &nodes);
     }
 
     iterator end()
     {
-        return iterator(nodes.back(), nodes);
+        return iterator(nodes.back(), &nodes);
     }
 
-    std::size_t size()
+    const_iterator begin() const
+    {
+        return const_iterator(nodes[0], &nodes);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(nodes.back(), &nodes);
+    }
+
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+
+    const_iterator cend() const
+    {
+        return end();
+    }
+
+    reverse_iterator rbegin()
+    {
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator rend()
+    {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rbegin() const
+    {
+        return const_reverse_iterator(end());
+    }
+
+    const_reverse_iterator rend() const
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    const_reverse_iterator crbegin() const
+    {
+        return rbegin();
+    }
+
+    const_reverse_iterator crend() const
+    {
+        return rend();
+    }
+
+    std::size_t size() const
     {
         // -1 for end() node
-        return nodes.size() - 1;
+        if constexpr (tombstones)
+            return nodes.size() - 1 - endNode.dead;
+        else
+            return nodes.size() - 1;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    // counters since construction or the last `reset_stats()`, needs `Options::collect_stats`
+    const stable_deque_stats &stats() const requires collectStats
+    {
+        return *statCounters;
+    }
+
+    void reset_stats() requires collectStats
+    {
+        *statCounters = stable_deque_stats{};
+    }
+
+    // makes room for `count` elements in total, only pooled nodes can be reserved
+    void reserve(std::size_t count)
+    {
+        if constexpr (Options::pooled_nodes)
+            nodePool.reserve(nodeAllocator, count);
+    }
+
+    // returns pool chunks that hold no element and trims `nodes`, elements keep their address
+    void shrink_to_fit()
+    {
+        if constexpr (Options::pooled_nodes)
+            nodePool.shrink(nodeAllocator);
+        nodes.shrink_to_fit();
+    }
+
+    stable_deque_memory_usage memory_usage() const
+    {
+        stable_deque_memory_usage usage;
+        usage.elements = size() * sizeof(T);
+        usage.node_overhead = size() * (sizeof(Node) - sizeof(T));
+        if constexpr (tombstones)
+            usage.tombstones = endNode.dead * sizeof(Node);
+        if constexpr (Options::pooled_nodes)
+        {
+            usage.idle_nodes = nodePool.capacity() * sizeof(Node) - usage.elements - usage.node_overhead - usage.tombstones;
+            usage.pool_overhead = nodePool.allocated_bytes() - nodePool.capacity() * sizeof(Node);
+        }
+        usage.node_table = deque_bytes_estimate<NodeBase *>(nodes.size());
+        if constexpr (tombstones)
+            usage.positions = endNode.ranks.allocated_bytes();
+        return usage;
     }
 
     void push_back(const T &value)
     {
-        insert(end(), value);
+        emplace_back(value);
+    }
+
+    void push_back(T &&value)
+    {
+        emplace_back(std::move(value));
+    }
+
+    template <typename... Args>
+    T &emplace_back(Args &&...args)
+    {
+        return *emplace(end(), std::forward<Args>(args)...);
     }
 
     void push_front(const T &value)
     {
-        Node *data = NodeAllocatorTraits::allocate(nodeAllocator, 1);
-        NodeAllocatorTraits::construct(nodeAllocator, data, value, 0);
+        emplace_front(value);
+    }
+
+    void push_front(T &&value)
+    {
+        emplace_front(std::move(value));
+    }
+
+    template <typename... Args>
+    T &emplace_front(Args &&...args)
+    {
+        Node *data = create_node(0, std::forward<Args>(args)...);
         nodes.insert(nodes.begin(), data);
-        fix_up_pointers<1>(begin() + 1, end());
+        ranks_inserted(0, 1);
+        fix_up_pointers(1, 1);
+        return data->data;
+    }
+
+    iterator insert(iterator iterator, const T &value)
+    {
+        return emplace(iterator, value);
+    }
+
+    iterator insert(iterator iterator, T &&value)
+    {
+        return emplace(iterator, std::move(value));
+    }
+
+    // inserts copies of `[first, last)` before `iterator` with a single insert into `nodes`
+    // and a single renumbering pass, returns an iterator to the first inserted element
+    template <std::input_iterator InputIt>
+    iterator insert(iterator iterator, InputIt first, InputIt last)
+    {
+        int64_t index = iterator.node->pos_in_nodes;
+        std::vector<NodeBase *, NodePAllocator> newNodes{NodePAllocator(nodeAllocator)};
+        if constexpr (std::forward_iterator<InputIt>)
+            newNodes.reserve(std::ranges::distance(first, last));
+        try
+        {
+            for (; first != last; ++first)
+                newNodes.push_back(create_node(index + newNodes.size(), *first));
+        }
+        catch (...)
+        {
+            for (auto *node : newNodes)
+                destroy_node(static_cast<Node *>(node));
+            throw;
+        }
+
+        if (newNodes.empty())
+            return iterator;
+        nodes.insert(nodes.begin() + index, newNodes.begin(), newNodes.end());
+        ranks_inserted(index, newNodes.size());
+        fix_up_pointers(index + newNodes.size(), newNodes.size());
+        return vector_stable_deque::iterator(newNodes.front(), &nodes);
     }
 
-    void insert(iterator iterator, const T &value)
+    // inserts `count` copies of `value` before `iterator`
+    iterator insert(iterator iterator, std::size_t count, const T &value)
     {
-        Node *data = NodeAllocatorTraits::allocate(nodeAllocator, 1);
-        NodeAllocatorTraits::construct(nodeAllocator, data, value, iterator.node->pos_in_nodes);
-        nodes.insert(nodes.begin() + iterator.node->pos_in_nodes, data);
-        fix_up_pointers<1>(iterator, end());
+        auto repeated = std::views::iota(std::size_t(0), count) | std::views::transform([&value](std::size_t) -> const T & { return value; });
+        return insert(iterator, repeated.begin(), repeated.end());
     }
 
-    void erase(iterator iterator)
+    template <std::ranges::input_range Range>
+    void append_range(Range &&range)
     {
-        Node *node = iterator.node;
+        insert(end(), std::ranges::begin(range), std::ranges::end(range));
+    }
+
+    template <std::ranges::input_range Range>
+    void prepend_range(Range &&range)
+    {
+        insert(begin(), std::ranges::begin(range), std::ranges::end(range));
+    }
+
+    // constructs the new element in place, right before `iterator`
+    template <typename... Args>
+    iterator emplace(iterator iterator, Args &&...args)
+    {
+        int64_t index = iterator.node->pos_in_nodes;
+        Node *data = create_node(index, std::forward<Args>(args)...);
+        nodes.insert(nodes.begin() + index, data);
+        ranks_inserted(index, 1);
+        fix_up_pointers(index + 1, 1);
+        return vector_stable_deque::iterator(data, &nodes);
+    }
+
+    iterator erase(iterator iterator)
+    {
+        Node *node = static_cast<Node *>(iterator.node);
+        int64_t index = node->pos_in_nodes;
         auto nextIter = iterator + 1;
-        nodes.erase(nodes.begin() + node->pos_in_nodes);
-        NodeAllocatorTraits::destroy(nodeAllocator, node);
-        NodeAllocatorTraits::deallocate(nodeAllocator, node, 1);
-        fix_up_pointers<-1>(nextIter, end());
+        if constexpr (tombstones)
+        {
+            if (index != 0 && index != (int64_t)nodes.size() - 2)
+                return bury(node, nextIter);
+        }
+        nodes.erase(nodes.begin() + index);
+        destroy_node(node);
+        ranks_removed(index, 1);
+        fix_up_pointers(index, -1);
+        if constexpr (tombstones)
+            trim_tombstones();
+        return nextIter;
     }
+
+    // erases `[first, last)` with a single renumbering pass, returns `last`
+    iterator erase(iterator first, iterator last)
+    {
+        int64_t index = first.node->pos_in_nodes;
+        int64_t count = last.node->pos_in_nodes - index;
+        if (count == 0)
+            return last;
+        auto underlyingFirst = nodes.begin() + index;
+        auto underlyingLast = underlyingFirst + count;
+        for (auto iter = underlyingFirst; iter != underlyingLast; ++iter)
+            destroy_node(static_cast<Node *>(*iter));
+        nodes.erase(underlyingFirst, underlyingLast);
+        ranks_removed(index, count);
+        fix_up_pointers(index, -count);
+        if constexpr (tombstones)
+            trim_tombstones();
+        return last;
+    }
+
+    // erases every element matching `predicate` (keeping the order of the rest)
+    // in one compaction pass, returns the number of erased elements
+    template <typename Predicate>
+    std::size_t erase_if(Predicate predicate)
+    {
+        int64_t tombstonesBefore = 0;
+        if constexpr (tombstones)
+            tombstonesBefore = endNode.dead;
+        auto write = nodes.begin();
+        for (auto read = nodes.begin(); read != nodes.end() - 1; ++read)
+        {
+            Node *node = static_cast<Node *>(*read);
+            if (is_dead(node) || predicate(std::as_const(node->data)))
+            {
+                destroy_node(node);
+                continue;
+            }
+            node->pos_in_nodes = write - nodes.begin();
+            *write++ = node;
+        }
+        std::size_t erased = nodes.end() - 1 - write - tombstonesBefore;
+        endNode.pos_in_nodes = write - nodes.begin();
+        *write++ = &endNode;
+        nodes.erase(write, nodes.end());
+        if constexpr (tombstones)
+            endNode.ranks.clear();
+        return erased;
+    }
+
+    // drops every tombstone (see `Options::tombstone_erase`) and renumbers, in one pass
+    void compact() requires tombstones
+    {
+        if (endNode.dead > 0)
+            erase_if([](const T &) { return false; });
+    }
+
+    void clear()
+    {
+        erase(begin(), end());
+    }
+
+    void resize(std::size_t count)
+    {
+        if constexpr (tombstones)
+            compact();
+        if (count < size())
+        {
+            erase(begin() + count, end());
+            return;
+        }
+        int64_t index = size();
+        std::vector<NodeBase *, NodePAllocator> newNodes{NodePAllocator(nodeAllocator)};
+        newNodes.reserve(count - size());
+        try
+        {
+            while (newNodes.size() < count - size())
+                newNodes.push_back(create_node(index + newNodes.size()));
+        }
+        catch (...)
+        {
+            for (auto *node : newNodes)
+                destroy_node(static_cast<Node *>(node));
+            throw;
+        }
+        nodes.insert(nodes.end() - 1, newNodes.begin(), newNodes.end());
+        ranks_inserted(nodes.size() - 1 - newNodes.size(), newNodes.size());
+        endNode.pos_in_nodes = nodes.size() - 1;
+    }
+
+    void resize(std::size_t count, const T &value)
+    {
+        if constexpr (tombstones)
+            compact();
+        if (count < size())
+            erase(begin() + count, end());
+        else
+            insert(end(), count - size(), value);
+    }
+
     T &operator[](int64_t index)
     {
         assert(index >= 0);
-        return nodes[index]->data;
+        if constexpr (tombstones)
+            return *(begin() + index);
+        else
+            return static_cast<Node *>(nodes[index])->data;
+    }
+
+    const T &operator[](int64_t index) const
+    {
+        assert(index >= 0);
+        if constexpr (tombstones)
+            return *(begin() + index);
+        else
+            return static_cast<const Node *>(nodes[index])->data;
+    }
+
+    // calls `function` on every element in order, walking `nodes` directly (no dependent
+    // iterator chain) and prefetching `Options::prefetch_distance` nodes ahead
+    template <typename Function>
+    void for_each(Function function)
+    {
+        walk_nodes<T>(nodes, function);
     }
-};
\ No newline at end of file
+
+    template <typename Function>
+    void for_each(Function function) const
+    {
+        walk_nodes<const T>(nodes, function);
+    }
+
+    // calls `function` with one random access range of `T&` per run of contiguous node pointers
+    // in `nodes` (a `std::deque` block), with `Options::prefetch_distance` the nodes of the
+    // following run are prefetched first
+    template <typename Function>
+    void for_each_segment(Function function)
+    {
+        walk_segments<T>(nodes, function);
+    }
+
+    template <typename Function>
+    void for_each_segment(Function function) const
+    {
+        walk_segments<const T>(nodes, function);
+    }
+};
+
+template <typename T, typename Allocator, typename Options, typename Predicate>
+std::size_t erase_if(vector_stable_deque<T, Allocator, Options> &container, Predicate predicate)
+{
+    return container.erase_if(predicate);
+}
+
+namespace pmr
+{
+// `vector_stable_deque` that takes all of its memory from a `std::pmr::memory_resource`
+template <typename T, typename Options = stable_deque_options>
+using vector_stable_deque = ::vector_stable_deque<T, std::pmr::polymorphic_allocator<T>, Options>;
+} // namespace pmr
@@ -0,0 +1,257 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+#include "node_pool.h"
+#include "stable_deque_options.h"
+
+/// Chase-Lev work-stealing deque (Lê, Pop, Cohen, Zappa Nardelli: "Correct and Efficient
+/// Work-Stealing for Weak Memory Models") with `stable_deque`'s guarantee that elements never move.
+/// The fences of the paper are folded into seq_cst operations on `top`/`bottom`, which costs the
+/// same on x86 and keeps the deque checkable with ThreadSanitizer.
+///
+/// One owner thread calls `push()`/`emplace()`/`pop()` on the back without taking any lock, any
+/// number of thieves call `steal()` on the front, which races through a CAS on `top`.
+/// Like in `stable_deque`, every element lives in its own node and the ring only holds node
+/// pointers, so growing the ring never touches an element and `emplace()` returns a reference
+/// that stays valid until the element is popped or stolen.
+///
+/// Nodes come from a `node_pool` that only the owner touches. A thief hands the node of a stolen
+/// element back through a lock-free list, which the owner drains on its next push.
+template <typename T, typename Allocator = std::allocator<T>, typename Options = stable_deque_options>
+class work_stealing_deque
+{
+	/// Takes over a node's storage once a thief has destroyed its element
+	struct ReturnedLink
+	{
+		ReturnedLink *next;
+	};
+
+	struct Node
+	{
+		/// `link` only becomes the active member after `data` is destroyed, in `return_node()`
+		union
+		{
+			T data;
+			ReturnedLink link;
+		};
+
+		template <typename... Args>
+		Node(Args &&...args) : data(std::forward<Args>(args)...)
+		{
+		}
+
+		~Node()
+		{
+			std::destroy_at(&data);
+		}
+	};
+
+	using NodeAllocator = std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+	using NodeAllocatorTraits = std::allocator_traits<NodeAllocator>;
+	NodeAllocator nodeAllocator;
+	node_pool<Node, NodeAllocator, Options::pool_chunk_bytes> nodePool;
+
+	/// Circular buffer of node pointers, indexed by `top`/`bottom` modulo `capacity`
+	struct Ring
+	{
+		int64_t capacity;
+		std::unique_ptr<std::atomic<Node *>[]> slots;
+
+		/// Rings that were outgrown stay alive until destruction, a thief may still read them
+		Ring *previous;
+
+		Ring(int64_t capacity, Ring *previous) :
+			capacity(capacity), slots(std::make_unique<std::atomic<Node *>[]>(capacity)), previous(previous)
+		{
+		}
+
+		Node *get(int64_t index) const
+		{
+			return slots[index & (capacity - 1)].load(std::memory_order_relaxed);
+		}
+
+		void put(int64_t index, Node *node)
+		{
+			slots[index & (capacity - 1)].store(node, std::memory_order_relaxed);
+		}
+	};
+
+	static constexpr int64_t initialCapacity = 64;
+
+	alignas(64) std::atomic<int64_t> top = 0;
+	alignas(64) std::atomic<int64_t> bottom = 0;
+	std::atomic<Ring *> ring = new Ring(initialCapacity, nullptr);
+	alignas(64) std::atomic<ReturnedLink *> returnedNodes = nullptr;
+
+	/// Doubles the ring, only ever called by the owner
+	Ring *grow(Ring *current, int64_t first, int64_t last)
+	{
+		Ring *bigger = new Ring(current->capacity * 2, current);
+		for (int64_t i = first; i < last; i++)
+			bigger->put(i, current->get(i));
+		ring.store(bigger, std::memory_order_release);
+		return bigger;
+	}
+
+	/// Moves the nodes thieves gave back onto the pool's free list
+	void reclaim_returned_nodes()
+	{
+		ReturnedLink *link = returnedNodes.exchange(nullptr, std::memory_order_acquire);
+		while (link != nullptr)
+		{
+			ReturnedLink *next = link->next;
+			nodePool.deallocate(reinterpret_cast<Node *>(link));
+			link = next;
+		}
+	}
+
+	/// Called by a thief, so it must not touch `nodeAllocator` or `nodePool`
+	void return_node(Node *node)
+	{
+		std::destroy_at(&node->data);
+		ReturnedLink *link = ::new (static_cast<void *>(&node->link)) ReturnedLink{returnedNodes.load(std::memory_order_relaxed)};
+		while (!returnedNodes.compare_exchange_weak(link->next, link, std::memory_order_release, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	static std::optional<T> take(Node *node)
+	{
+		return std::optional<T>(std::move(node->data));
+	}
+
+public:
+	using value_type = T;
+	using allocator_type = Allocator;
+
+	work_stealing_deque() = default;
+	work_stealing_deque(const work_stealing_deque &) = delete;
+	work_stealing_deque &operator=(const work_stealing_deque &) = delete;
+
+	/// Not thread safe, nobody may be stealing anymore
+	~work_stealing_deque()
+	{
+		Ring *current = ring.load(std::memory_order_relaxed);
+		int64_t last = bottom.load(std::memory_order_relaxed);
+		for (int64_t i = top.load(std::memory_order_relaxed); i < last; i++)
+			NodeAllocatorTraits::destroy(nodeAllocator, current->get(i));
+		while (current != nullptr)
+		{
+			Ring *previous = current->previous;
+			delete current;
+			current = previous;
+		}
+		nodePool.release(nodeAllocator);
+	}
+
+	// Owner only
+
+	void push(const T &value)
+	{
+		emplace(value);
+	}
+
+	void push(T &&value)
+	{
+		emplace(std::move(value));
+	}
+
+	/// Constructs an element at the back. The reference stays valid until the element is popped or stolen.
+	template <typename... Args>
+	T &emplace(Args &&...args)
+	{
+		if (returnedNodes.load(std::memory_order_relaxed) != nullptr)
+			reclaim_returned_nodes();
+
+		Node *node = nodePool.allocate(nodeAllocator);
+		try
+		{
+			NodeAllocatorTraits::construct(nodeAllocator, node, std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			nodePool.deallocate(node);
+			throw;
+		}
+
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		Ring *current = ring.load(std::memory_order_relaxed);
+		if (b - t > current->capacity - 1) [[unlikely]]
+			current = grow(current, t, b);
+		current->put(b, node);
+		bottom.store(b + 1, std::memory_order_release);
+		return node->data;
+	}
+
+	/// Removes and returns the last element, or nothing if the deque is empty
+	std::optional<T> pop()
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		Ring *current = ring.load(std::memory_order_relaxed);
+		bottom.store(b, std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_seq_cst);
+
+		if (t > b)
+		{
+			// Empty
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return std::nullopt;
+		}
+
+		Node *node = current->get(b);
+		if (t == b)
+		{
+			// Last element, race the thieves for it
+			bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			if (!won)
+				return std::nullopt;
+		}
+
+		std::optional<T> value = take(node);
+		NodeAllocatorTraits::destroy(nodeAllocator, node);
+		nodePool.deallocate(node);
+		return value;
+	}
+
+	// Any thread
+
+	/// Removes and returns the first element. Returns nothing if the deque is empty or another thread
+	/// took the element first.
+	std::optional<T> steal()
+	{
+		int64_t t = top.load(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_seq_cst);
+		if (t >= b)
+			return std::nullopt;
+
+		Node *node = ring.load(std::memory_order_acquire)->get(t);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return std::nullopt;
+
+		// The node is ours now, only its owner pool isn't
+		std::optional<T> value = take(node);
+		return_node(node);
+		return value;
+	}
+
+	/// Racy snapshot, exact only while no other thread touches the deque
+	std::size_t size() const
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_relaxed);
+		return b > t ? (std::size_t)(b - t) : 0;
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+};